@@ -0,0 +1,150 @@
+// checks that calls with fixed-size arguments and results don't allocate on the calling thread once warmed up:
+// call_function, a typed stub and a stub decoding a container into reserved storage, against a server in
+// both modes. Exits with 1 when any of them allocated, so the guarantee is kept by the test run.
+// Built as the rpc_allocations target (linked with rpc_accounting) and run by ctest:
+//   cmake -S . -B build && cmake --build build && ctest --test-dir build
+// usage: rpc_allocations [--port <first port>] [--calls <n>]
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../rpc/server.h"
+#include "../rpc/client.h"
+
+static_assert(misc::accounting::enabled, "rpc_allocations counts allocations, it must be built with RPC_ACCOUNTING");
+
+namespace allocations
+{
+
+	struct options
+	{
+		std::uint16_t port = 39400;
+		std::size_t calls = 1000;
+	};
+
+	float add(float first, float second) { return first + second; }
+
+	std::vector<std::int32_t> range(std::int32_t count)
+	{
+		std::vector<std::int32_t> values(static_cast<std::size_t>(count));
+		for (std::int32_t i = 0; i < count; ++i)
+			values[static_cast<std::size_t>(i)] = i;
+		return values;
+	}
+
+	// calls the operation until warmed up, then counts what the calling thread allocates over calls more
+	bool check(std::string_view name, std::size_t calls, rpc::client& client, const std::function<bool()>& call)
+	{
+		for (std::size_t i = 0; i < 100; ++i) {
+			if (!call()) {
+				std::cout << name << ": call failed, error " << static_cast<int>(client.get_error()) << '\n';
+				return false;
+			}
+		}
+		misc::accounting::scope measured;
+		bool succeeded = true;
+		for (std::size_t i = 0; i < calls; ++i)
+			succeeded = call() && succeeded;
+		const misc::accounting::counters counted = measured.counted();
+
+		std::cout << name << ": " << counted.allocations << " allocations (" << counted.allocated_bytes
+			<< " bytes) in " << calls << " calls\n";
+		if (!succeeded)
+			std::cout << name << ": call failed, error " << static_cast<int>(client.get_error()) << '\n';
+		return succeeded && counted.allocations == 0;
+	}
+
+	bool check_client(const options& settings, std::uint16_t port, bool sharded)
+	{
+		rpc::client client;
+		const rpc::handle_t server_id = client.connect({ "127.0.0.1", port });
+		if (server_id == rpc::null_handle) {
+			std::cout << "Failed to connect to the server on port " << port << '\n';
+			return false;
+		}
+		const std::string mode = sharded ? "sharded " : "thread_per_connection ";
+
+		float sum = 0;
+		bool passed = check(mode + "call_function", settings.calls, client, [&]() {
+			misc::buffer<> reply = client.call_function(server_id, "add", sum, 1.0f);
+			if (reply.is_empty())
+				return false;
+			sum = reply.cast<float>();
+			return true;
+		});
+
+		rpc::stub<float(float, float)> add_stub = client.bind<float(float, float)>(server_id, "add");
+		passed = check(mode + "stub", settings.calls, client, [&]() {
+			client.null_error();
+			sum = add_stub(sum, 1.0f);
+			return client.get_error() == rpc::errors::no_error;
+		}) && passed;
+
+		rpc::stub<std::vector<std::int32_t>(std::int32_t)> range_stub = client.bind<std::vector<std::int32_t>(std::int32_t)>(server_id, "range");
+		std::vector<std::int32_t> values;
+		values.reserve(1024);
+		passed = check(mode + "stub_into_reserved_vector", settings.calls, client, [&]() {
+			return range_stub.into(values, 1024) && values.size() == 1024;
+		}) && passed;
+		return passed;
+	}
+
+	bool check_server(const options& settings, std::uint16_t port, bool sharded)
+	{
+		rpc::server server({ "127.0.0.1", port });
+		server.register_function("add", &add);
+		server.register_function("range", &range);
+		std::thread runner([&server, sharded]() {
+			if (sharded) {
+				rpc::shard_policy policy;
+				policy.shards = 1;
+				policy.pin_threads = false;
+				server.run_sharded(policy);
+			}
+			else {
+				server.run();
+			}
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		const bool passed = check_client(settings, port, sharded);
+		server.stop();
+		runner.join();
+		return passed;
+	}
+
+	bool parse(int argc, char** argv, options& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string_view argument = argv[i];
+			if (i + 1 >= argc)
+				return false;
+			if (argument == "--port")
+				settings.port = static_cast<std::uint16_t>(std::stoi(argv[++i]));
+			else if (argument == "--calls")
+				settings.calls = std::stoul(argv[++i]);
+			else
+				return false;
+		}
+		return settings.calls > 0;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	allocations::options settings;
+	if (!allocations::parse(argc, argv, settings)) {
+		std::cerr << "usage: rpc_allocations [--port <first port>] [--calls <n>]\n";
+		return 1;
+	}
+	const bool threaded = allocations::check_server(settings, settings.port, false);
+	const bool sharded = allocations::check_server(settings, static_cast<std::uint16_t>(settings.port + 1), true);
+	return (threaded && sharded) ? 0 : 1;
+}
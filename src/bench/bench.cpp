@@ -0,0 +1,391 @@
+// microbenchmarks of the hot paths, results are written as JSON to track regressions between releases.
+// Built as the rpc_bench target:
+//   cmake -S . -B build && cmake --build build --target rpc_bench
+// configured with -DRPC_ACCOUNTING=ON, allocations and copied bytes per operation
+// are reported as well (the operations run slower then)
+// usage: rpc_bench [--filter <substring>] [--output <file.json>] [--port <first port>] [--min-time <ms>]
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../rpc/server.h"
+#include "../rpc/client.h"
+#include "../rpc/statistics.h"
+
+namespace bench
+{
+
+	using clock = std::chrono::steady_clock;
+
+	// keeps the compiler from dropping the computation of value
+	template<typename T>
+	inline void keep(const T& value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static const void* volatile sink;
+		sink = &value;
+#endif
+	}
+
+	struct result
+	{
+		std::string name;
+		std::uint64_t iterations = 0;
+		double ns_per_op = 0;
+		// only measured per operation by the round trip benchmarks
+		bool has_percentiles = false;
+		std::uint64_t p50 = 0;
+		std::uint64_t p99 = 0;
+		std::uint64_t p999 = 0;
+		std::uint64_t max = 0;
+		// of the calling thread, RPC_ACCOUNTING only
+		double allocations_per_op = 0;
+		double copied_bytes_per_op = 0;
+	};
+
+	struct options
+	{
+		std::string filter;
+		std::string output;
+		std::uint16_t port = 19000;
+		std::chrono::milliseconds min_time = std::chrono::milliseconds(200);
+	};
+
+	class suite
+	{
+	private:
+		options m_options;
+		std::vector<result> m_results;
+
+	public:
+		explicit suite(const options& settings) : m_options(settings) {}
+
+		bool selected(std::string_view name) const
+		{
+			return m_options.filter.empty() || name.find(m_options.filter) != std::string_view::npos;
+		}
+
+		// doubles the batch until it runs for min_time, the last batch is reported
+		template<typename Body>
+		void measure(std::string_view name, Body&& body)
+		{
+			if (!selected(name))
+				return;
+			for (int i = 0; i < 1000; ++i)
+				body();
+			std::uint64_t iterations = 1;
+			while (true) {
+				const misc::accounting::scope accounted;
+				const auto start = clock::now();
+				for (std::uint64_t i = 0; i < iterations; ++i)
+					body();
+				const auto elapsed = clock::now() - start;
+				const misc::accounting::counters counted = accounted.counted();
+				if (elapsed >= m_options.min_time || iterations >= (std::uint64_t(1) << 32)) {
+					result measured;
+					measured.name = name;
+					measured.iterations = iterations;
+					measured.ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+					account(measured, counted);
+					report(measured);
+					return;
+				}
+				iterations *= 2;
+			}
+		}
+
+		// times every operation on its own, for operations long enough to take the clock twice
+		template<typename Body>
+		void measure_each(std::string_view name, std::uint64_t iterations, Body&& body)
+		{
+			if (!selected(name))
+				return;
+			for (std::uint64_t i = 0; i < iterations / 10; ++i)
+				body();
+			rpc::latency_histogram histogram;
+			const misc::accounting::scope accounted;
+			const auto start = clock::now();
+			for (std::uint64_t i = 0; i < iterations; ++i) {
+				const auto begin = clock::now();
+				body();
+				histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - begin));
+			}
+			const auto elapsed = clock::now() - start;
+			const misc::accounting::counters counted = accounted.counted();
+
+			result measured;
+			measured.name = name;
+			measured.iterations = iterations;
+			measured.ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+			account(measured, counted);
+			measured.has_percentiles = true;
+			measured.p50 = histogram.percentile(0.5);
+			measured.p99 = histogram.percentile(0.99);
+			measured.p999 = histogram.percentile(0.999);
+			measured.max = histogram.max();
+			report(measured);
+		}
+
+		const options& settings() const { return m_options; }
+
+		void write_json(std::ostream& output) const
+		{
+			output << "{\n\t\"context\": { \"hardware_threads\": " << std::thread::hardware_concurrency() << " },\n";
+			output << "\t\"benchmarks\": [";
+			for (std::size_t i = 0; i < m_results.size(); ++i) {
+				const result& measured = m_results[i];
+				output << (i ? ",\n" : "\n") << "\t\t{ \"name\": \"" << measured.name << "\", \"iterations\": " << measured.iterations
+					<< ", \"ns_per_op\": " << measured.ns_per_op;
+				if (measured.has_percentiles) {
+					output << ", \"p50_ns\": " << measured.p50 << ", \"p99_ns\": " << measured.p99
+						<< ", \"p999_ns\": " << measured.p999 << ", \"max_ns\": " << measured.max;
+				}
+				if (misc::accounting::enabled) {
+					output << ", \"allocations_per_op\": " << measured.allocations_per_op
+						<< ", \"copied_bytes_per_op\": " << measured.copied_bytes_per_op;
+				}
+				output << " }";
+			}
+			output << "\n\t]\n}\n";
+		}
+
+	private:
+		static void account(result& measured, const misc::accounting::counters& counted)
+		{
+			measured.allocations_per_op = static_cast<double>(counted.allocations) / measured.iterations;
+			measured.copied_bytes_per_op = static_cast<double>(counted.copied_bytes) / measured.iterations;
+		}
+
+		void report(const result& measured)
+		{
+			// progress goes to stderr, so stdout stays valid JSON
+			std::cerr << measured.name << ": " << measured.ns_per_op << " ns/op\n";
+			m_results.push_back(measured);
+		}
+	};
+
+	float add(float first, float second) { return first + second; }
+
+	void buffer_benchmarks(suite& runner)
+	{
+		const std::string text(64, 'x');
+		const std::vector<int> numbers(256, 7);
+
+		misc::buffer<> buffer(4 * net::kilobyte);
+		runner.measure("buffer_add_pod", [&]() {
+			buffer.clear();
+			buffer.add(1.5f, 2, 3.0);
+			keep(buffer.data());
+		});
+		runner.measure("buffer_add_string_64", [&]() {
+			buffer.clear();
+			buffer.add(text);
+			keep(buffer.data());
+		});
+		runner.measure("buffer_add_vector_256", [&]() {
+			buffer.clear();
+			buffer.add(numbers);
+			keep(buffer.data());
+		});
+
+		misc::buffer<> pod(sizeof(float));
+		pod.add(1.5f);
+		runner.measure("buffer_cast_pod", [&]() {
+			keep(pod.cast<float>());
+		});
+		misc::buffer<> container(sizeof(std::size_t) + numbers.size() * sizeof(int));
+		container.add(numbers);
+		runner.measure("buffer_cast_vector_256", [&]() {
+			keep(container.cast<std::vector<int>>().size());
+		});
+	}
+
+	void packet_benchmarks(suite& runner)
+	{
+		const rpc::id_t id = std::hash<std::string_view>{}("add");
+		const std::string text(64, 'x');
+		const std::vector<int> numbers(256, 7);
+
+		runner.measure("form_packet_pod", [&]() {
+			misc::buffer<> packet = rpc::form_packet(rpc::opcodes::call_function, id, 1.5f, 2.5f);
+			keep(packet.data());
+		});
+		runner.measure("form_packet_string_64", [&]() {
+			misc::buffer<> packet = rpc::form_packet(rpc::opcodes::call_function, id, text);
+			keep(packet.data());
+		});
+		runner.measure("form_packet_vector_256", [&]() {
+			misc::buffer<> packet = rpc::form_packet(rpc::opcodes::call_function, id, numbers);
+			keep(packet.data());
+		});
+	}
+
+	// arguments as the server finds them after the opcode and function id
+	template<typename ...Args>
+	misc::buffer<> packed(const Args&... args)
+	{
+		misc::buffer<> arguments(misc::encoded_size(args...));
+		arguments.add(args...);
+		return arguments;
+	}
+
+	void unpack_benchmarks(suite& runner, rpc::server& server)
+	{
+		misc::buffer<> pods = packed(1.5f, 2.5f, 3);
+		runner.measure("unpack_pod", [&]() {
+			std::tuple<float, float, int> arguments;
+			server.unpack(arguments, pods, std::make_index_sequence<3>{});
+			keep(arguments);
+		});
+		misc::buffer<> text = packed(std::string(64, 'x'));
+		runner.measure("unpack_string_64", [&]() {
+			std::tuple<std::string> arguments;
+			server.unpack(arguments, text, std::make_index_sequence<1>{});
+			keep(std::get<0>(arguments).size());
+		});
+		misc::buffer<> numbers = packed(std::vector<int>(256, 7));
+		runner.measure("unpack_vector_256", [&]() {
+			std::tuple<std::vector<int>> arguments;
+			server.unpack(arguments, numbers, std::make_index_sequence<1>{});
+			keep(std::get<0>(arguments).size());
+		});
+	}
+
+	// calls through the registered function table holding count functions
+	void dispatch_benchmark(suite& runner, std::size_t count)
+	{
+		const std::string name = "dispatch_" + std::to_string(count);
+		if (!runner.selected(name))
+			return;
+		// port 0, the server is never run
+		rpc::server server({ "127.0.0.1", 0 });
+		std::vector<rpc::id_t> ids;
+		for (std::size_t i = 0; i < count; ++i) {
+			ids.push_back(std::hash<std::string>{}("function_" + std::to_string(i)));
+			server.register_function(ids.back(), []() { return 0; });
+		}
+		misc::buffer<> arguments(16);
+		std::size_t next = 0;
+		runner.measure(name, [&]() {
+			// spread over the table, so lookups don't always hit the same cache lines
+			next = (next + 7919) % ids.size();
+			misc::buffer<> reply = server.call_function(ids[next], arguments);
+			keep(reply.data());
+		});
+	}
+
+	// client side of round_trip_benchmark; typed calls go through a stub bound once instead of call_function
+	void measure_round_trips(suite& runner, std::string_view name, std::uint16_t port, bool typed)
+	{
+		rpc::client client;
+		const rpc::handle_t server_id = client.connect({ "127.0.0.1", port });
+		if (server_id == rpc::null_handle) {
+			std::cerr << "Failed to connect to the benchmark server on port " << port << '\n';
+			return;
+		}
+		float sum = 0;
+		if (typed) {
+			rpc::stub<float(float, float)> add_stub = client.bind<float(float, float)>(server_id, "add");
+			runner.measure_each(name, 20000, [&]() { sum = add_stub(sum, 1.0f); });
+			keep(sum);
+			return;
+		}
+		runner.measure_each(name, 20000, [&]() {
+			misc::buffer<> reply = client.call_function(server_id, "add", sum, 1.0f);
+			if (!reply.is_empty())
+				sum = reply.cast<float>();
+		});
+		keep(sum);
+	}
+
+	// full calls over 127.0.0.1, against a server stopped once measured
+	void round_trip_benchmark(suite& runner, std::string_view name, std::uint16_t port, bool sharded, bool typed = false)
+	{
+		if (!runner.selected(name))
+			return;
+		rpc::server server({ "127.0.0.1", port });
+		server.register_function("add", &add);
+		std::thread server_thread([&server, sharded]() {
+			if (sharded) {
+				rpc::shard_policy policy;
+				policy.shards = 1;
+				policy.pin_threads = false;
+				server.run_sharded(policy);
+			}
+			else {
+				server.run();
+			}
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		measure_round_trips(runner, name, port, typed);
+		server.stop();
+		server_thread.join();
+	}
+
+	bool parse(int argc, char** argv, options& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string_view argument = argv[i];
+			if (i + 1 >= argc)
+				return false;
+			if (argument == "--filter")
+				settings.filter = argv[++i];
+			else if (argument == "--output")
+				settings.output = argv[++i];
+			else if (argument == "--port")
+				settings.port = static_cast<std::uint16_t>(std::stoi(argv[++i]));
+			else if (argument == "--min-time")
+				settings.min_time = std::chrono::milliseconds(std::stoi(argv[++i]));
+			else
+				return false;
+		}
+		return true;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	bench::options settings;
+	if (!bench::parse(argc, argv, settings)) {
+		std::cerr << "usage: rpc_bench [--filter <substring>] [--output <file.json>] [--port <first port>] [--min-time <ms>]\n";
+		return 1;
+	}
+	bench::suite runner(settings);
+
+	bench::buffer_benchmarks(runner);
+	bench::packet_benchmarks(runner);
+	{
+		rpc::server server({ "127.0.0.1", 0 });
+		bench::unpack_benchmarks(runner, server);
+	}
+	for (std::size_t count : { 10, 1000, 100000 })
+		bench::dispatch_benchmark(runner, count);
+	bench::round_trip_benchmark(runner, "round_trip_thread_per_connection", settings.port, false);
+	bench::round_trip_benchmark(runner, "round_trip_sharded", settings.port + 1, true);
+	bench::round_trip_benchmark(runner, "round_trip_typed_stub", settings.port + 2, false, true);
+
+	if (settings.output.empty()) {
+		runner.write_json(std::cout);
+		return 0;
+	}
+	std::ofstream file(settings.output);
+	runner.write_json(file);
+	if (!file) {
+		std::cerr << "Failed to write " << settings.output << '\n';
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,313 @@
+// load generator for sizing servers and validating performance changes: runs closed loop
+// (every connection calls again as soon as its reply arrives) or open loop (calls arrive at a fixed
+// rate whatever the latency) and reports throughput and latency percentiles corrected for coordinated
+// omission. The called function must take one std::string (or a container of bytes), or nothing
+// with --payload 0. Built as the rpc_load target:
+//   cmake -S . -B build && cmake --build build --target rpc_load
+// usage: rpc_load [--host <ip>] [--port <port>] [--function <name>] [--payload <bytes>]
+//                 [--connections <n>] [--rate <calls per second>] [--duration <s>] [--warmup <s>]
+//                 [--expected-interval <us>] [--output <file.json>]
+//        rpc_load --serve [--port <port>]   runs a server with echo(std::string) and noop()
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../rpc/server.h"
+#include "../rpc/client.h"
+#include "../rpc/statistics.h"
+
+namespace load
+{
+
+	using clock = std::chrono::steady_clock;
+
+	struct options
+	{
+		std::string host = "127.0.0.1";
+		std::uint16_t port = rpc::default_port;
+		std::string function = "echo";
+		std::size_t payload = 64;
+		std::size_t connections = 1;
+		// calls per second over all connections, 0 runs closed loop
+		double rate = 0;
+		std::chrono::seconds duration = std::chrono::seconds(10);
+		std::chrono::seconds warmup = std::chrono::seconds(2);
+		// closed loop: time a call is expected to take, a slower call stood in the way of the calls
+		// that would have been sent meanwhile; 0 takes the median of the warmup
+		std::chrono::microseconds expected_interval = std::chrono::microseconds(0);
+		std::string output;
+		bool serve = false;
+	};
+
+	struct worker_result
+	{
+		// from when the call was sent
+		rpc::latency_histogram service;
+		// from when the call should have been sent, corrected for coordinated omission
+		rpc::latency_histogram response;
+		std::uint64_t calls = 0;
+		std::uint64_t errors = 0;
+		bool connected = false;
+	};
+
+	class caller
+	{
+	private:
+		rpc::client m_client;
+		rpc::handle_t m_server = rpc::null_handle;
+		rpc::id_t m_function;
+		std::string m_payload;
+		bool m_has_payload;
+
+	public:
+		explicit caller(const options& settings)
+			: m_function(std::hash<std::string_view>{}(settings.function)), m_payload(settings.payload, 'x'),
+			m_has_payload(settings.payload > 0)
+		{
+			m_server = m_client.connect({ settings.host.c_str(), settings.port });
+		}
+
+		bool is_connected() const { return m_server != rpc::null_handle; }
+
+		// false if the call failed
+		bool call()
+		{
+			m_client.null_error();
+			misc::buffer<> reply = m_has_payload
+				? m_client.call_function(m_server, m_function, m_payload)
+				: m_client.call_function(m_server, m_function);
+			return !reply.is_null() && m_client.get_error() == rpc::errors::no_error;
+		}
+	};
+
+	inline std::chrono::nanoseconds since(clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+	}
+
+	// a call taking latency kept the calls that would have followed every interval from being sent,
+	// they are recorded with the latency they would have seen (HdrHistogram's expected interval correction)
+	inline void record_corrected(rpc::latency_histogram& histogram, std::chrono::nanoseconds latency, std::chrono::nanoseconds interval)
+	{
+		histogram.record(latency);
+		if (interval.count() <= 0)
+			return;
+		for (std::chrono::nanoseconds missed = latency - interval; missed >= interval; missed -= interval)
+			histogram.record(missed);
+	}
+
+	void closed_loop(const options& settings, clock::time_point measure_from, clock::time_point end, worker_result& result)
+	{
+		caller target(settings);
+		result.connected = target.is_connected();
+		if (!result.connected)
+			return;
+
+		rpc::latency_histogram warmup;
+		std::chrono::nanoseconds interval = settings.expected_interval;
+		bool measuring = false;
+		while (true) {
+			const clock::time_point start = clock::now();
+			if (start >= end)
+				break;
+			if (!measuring && start >= measure_from) {
+				measuring = true;
+				if (interval.count() <= 0)
+					interval = std::chrono::nanoseconds(warmup.percentile(0.5));
+			}
+			const bool succeeded = target.call();
+			const std::chrono::nanoseconds latency = since(start);
+			if (!measuring) {
+				warmup.record(latency);
+				continue;
+			}
+			++result.calls;
+			if (!succeeded)
+				++result.errors;
+			result.service.record(latency);
+			record_corrected(result.response, latency, interval);
+		}
+	}
+
+	// sleeping alone oversleeps by the timer slack, which would be reported as latency of the server;
+	// the rest is waited out yielding, so a server on the same cores still runs
+	inline void wait_until(clock::time_point time)
+	{
+		const std::chrono::microseconds spin = std::chrono::microseconds(200);
+		if (time - clock::now() > spin)
+			std::this_thread::sleep_until(time - spin);
+		while (clock::now() < time)
+			std::this_thread::yield();
+	}
+
+	// calls of the connection are scheduled every interval from start, a call sent late
+	// still counts its latency from its scheduled time
+	void open_loop(const options& settings, clock::time_point start, std::chrono::nanoseconds interval,
+		clock::time_point measure_from, clock::time_point end, worker_result& result)
+	{
+		caller target(settings);
+		result.connected = target.is_connected();
+		if (!result.connected)
+			return;
+
+		for (std::uint64_t sent = 0; ; ++sent) {
+			const clock::time_point scheduled = start + interval * static_cast<std::int64_t>(sent);
+			if (scheduled >= end)
+				break;
+			wait_until(scheduled);
+			const clock::time_point sending = clock::now();
+			const bool succeeded = target.call();
+			if (scheduled < measure_from)
+				continue;
+			++result.calls;
+			if (!succeeded)
+				++result.errors;
+			result.service.record(since(sending));
+			result.response.record(since(scheduled));
+		}
+	}
+
+	void write_latency(std::ostream& output, const char* name, const rpc::latency_histogram& histogram)
+	{
+		output << "\t\"" << name << "\": { \"p50\": " << histogram.percentile(0.5) / 1000.0
+			<< ", \"p99\": " << histogram.percentile(0.99) / 1000.0
+			<< ", \"p999\": " << histogram.percentile(0.999) / 1000.0
+			<< ", \"max\": " << histogram.max() / 1000.0 << " }";
+	}
+
+	int run(const options& settings)
+	{
+		const std::size_t connections = std::max<std::size_t>(settings.connections, 1);
+		std::vector<worker_result> results(connections);
+		std::vector<std::thread> workers;
+
+		// connections are opened before the clock starts
+		const clock::time_point start = clock::now() + std::chrono::milliseconds(200);
+		const clock::time_point measure_from = start + settings.warmup;
+		const clock::time_point end = measure_from + settings.duration;
+		for (std::size_t i = 0; i < connections; ++i) {
+			if (settings.rate > 0) {
+				const std::chrono::nanoseconds interval(static_cast<std::int64_t>(1e9 * connections / settings.rate));
+				// connections are staggered, so together they send at an even rate
+				const clock::time_point first = start + interval * static_cast<std::int64_t>(i) / static_cast<std::int64_t>(connections);
+				workers.emplace_back(open_loop, std::cref(settings), first, interval, measure_from, end, std::ref(results[i]));
+			}
+			else {
+				workers.emplace_back(closed_loop, std::cref(settings), measure_from, end, std::ref(results[i]));
+			}
+		}
+		for (std::thread& worker : workers)
+			worker.join();
+
+		worker_result total;
+		std::size_t connected = 0;
+		for (const worker_result& result : results) {
+			if (result.connected)
+				++connected;
+			total.service.merge(result.service);
+			total.response.merge(result.response);
+			total.calls += result.calls;
+			total.errors += result.errors;
+		}
+		if (connected == 0) {
+			std::cerr << "Failed to connect to " << settings.host << ':' << settings.port << '\n';
+			return 1;
+		}
+
+		const double seconds = std::chrono::duration<double>(settings.duration).count();
+		std::ofstream file;
+		if (!settings.output.empty())
+			file.open(settings.output);
+		std::ostream& output = settings.output.empty() ? std::cout : file;
+		output << "{\n\t\"mode\": \"" << (settings.rate > 0 ? "open" : "closed") << "\",\n"
+			<< "\t\"function\": \"" << settings.function << "\",\n"
+			<< "\t\"payload_bytes\": " << settings.payload << ",\n"
+			<< "\t\"connections\": " << connected << ",\n"
+			<< "\t\"target_rate\": " << settings.rate << ",\n"
+			<< "\t\"duration_s\": " << seconds << ",\n"
+			<< "\t\"calls\": " << total.calls << ",\n"
+			<< "\t\"errors\": " << total.errors << ",\n"
+			<< "\t\"throughput\": " << total.calls / seconds << ",\n";
+		// latencies in microseconds
+		write_latency(output, "latency_us", total.response);
+		output << ",\n";
+		write_latency(output, "uncorrected_latency_us", total.service);
+		output << "\n}\n";
+		if (!output) {
+			std::cerr << "Failed to write " << settings.output << '\n';
+			return 1;
+		}
+		return 0;
+	}
+
+	std::string echo(std::string payload) { return payload; }
+	void noop() {}
+
+	int serve(const options& settings)
+	{
+		rpc::server server({ "0.0.0.0", settings.port });
+		server.register_function("echo", &echo);
+		server.register_function("noop", &noop);
+		server.run();
+		return 0;
+	}
+
+	bool parse(int argc, char** argv, options& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string_view argument = argv[i];
+			if (argument == "--serve") {
+				settings.serve = true;
+				continue;
+			}
+			if (i + 1 >= argc)
+				return false;
+			const std::string value = argv[++i];
+			if (argument == "--host")
+				settings.host = value;
+			else if (argument == "--port")
+				settings.port = static_cast<std::uint16_t>(std::stoi(value));
+			else if (argument == "--function")
+				settings.function = value;
+			else if (argument == "--payload")
+				settings.payload = std::stoull(value);
+			else if (argument == "--connections")
+				settings.connections = std::stoull(value);
+			else if (argument == "--rate")
+				settings.rate = std::stod(value);
+			else if (argument == "--duration")
+				settings.duration = std::chrono::seconds(std::stoll(value));
+			else if (argument == "--warmup")
+				settings.warmup = std::chrono::seconds(std::stoll(value));
+			else if (argument == "--expected-interval")
+				settings.expected_interval = std::chrono::microseconds(std::stoll(value));
+			else if (argument == "--output")
+				settings.output = value;
+			else
+				return false;
+		}
+		return true;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	load::options settings;
+	if (!load::parse(argc, argv, settings)) {
+		std::cerr << "usage: rpc_load [--host <ip>] [--port <port>] [--function <name>] [--payload <bytes>]\n"
+			"                [--connections <n>] [--rate <calls per second>] [--duration <s>] [--warmup <s>]\n"
+			"                [--expected-interval <us>] [--output <file.json>]\n"
+			"       rpc_load --serve [--port <port>]\n";
+		return 1;
+	}
+	return settings.serve ? load::serve(settings) : load::run(settings);
+}
\ No newline at end of file
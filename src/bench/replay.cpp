@@ -0,0 +1,273 @@
+// replays a capture taken with server::start_capture against a server: every captured connection is
+// opened again and sends its frames in their original order at their original times, scaled by --speed,
+// so load shapes of production can be reproduced without its network and builds compared on the same input.
+// Replies are read and counted by their status, not compared. Frames are sent byte for byte, the negotiation
+// included, so a connection ends up with the features it negotiated when captured. Objects are addressed by
+// the hash of the name their creator gave them: method calls are answered sensibly only if the target server
+// has the objects already or the capture holds their create_object frames, i.e. it started before they were
+// created. Built as the rpc_replay target:
+//   cmake -S . -B build && cmake --build build --target rpc_replay
+// usage: rpc_replay <capture file> [--host <ip>] [--port <port>] [--speed <factor>] [--drain <ms>] [--output <file.json>]
+//   --speed 2 replays twice as fast, 0 sends every frame as soon as the one before it is sent
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../rpc/channel.h"
+#include "../rpc/capture.h"
+#include "../rpc/statistics.h"
+
+namespace replay
+{
+
+	using clock = std::chrono::steady_clock;
+
+	struct options
+	{
+		std::string capture;
+		std::string host = "127.0.0.1";
+		std::uint16_t port = rpc::default_port;
+		double speed = 1;
+		// replies are waited for until the connection is quiet this long after its last frame
+		std::chrono::milliseconds drain = std::chrono::milliseconds(1000);
+		std::string output;
+	};
+
+	struct connection_result
+	{
+		std::uint64_t sent = 0;
+		std::uint64_t received = 0;
+		// replies with a status other than good, and replies too short for a status or with an unknown one
+		std::uint64_t errors = 0;
+		std::uint64_t invalid = 0;
+		// how late frames were sent compared to their scaled capture time
+		rpc::latency_histogram lag;
+		bool connected = false;
+		bool failed = false;
+	};
+
+	// captured frames grouped by connection, in the order they were received
+	using capture_t = std::map<std::uint32_t, std::vector<rpc::captured_frame>>;
+
+	bool load(const std::string& path, capture_t& frames, std::uint64_t& count, std::uint64_t& duration)
+	{
+		rpc::capture_reader reader;
+		if (!reader.open(path))
+			return false;
+		rpc::captured_frame frame;
+		while (reader.next(frame)) {
+			duration = std::max(duration, frame.time);
+			++count;
+			frames[frame.connection].push_back(std::move(frame));
+		}
+		return true;
+	}
+
+	inline void wait_until(clock::time_point time)
+	{
+		const std::chrono::microseconds spin = std::chrono::microseconds(200);
+		if (time - clock::now() > spin)
+			std::this_thread::sleep_until(time - spin);
+		while (clock::now() < time)
+			std::this_thread::yield();
+	}
+
+	// replies start with their status; stream chunks have none and the end of a stream may leave it out
+	void count_reply(const rpc::frame_header& header, const misc::buffer<>& payload, connection_result& result)
+	{
+		if (header.flags & rpc::frame_flags::stream_chunk)
+			return;
+		if (payload.size() < sizeof(rpc::status_t)) {
+			if (!(header.flags & rpc::frame_flags::stream_end))
+				++result.invalid;
+			return;
+		}
+		const rpc::status_t status = misc::get<rpc::status_t>(payload.data(), 0);
+		if (status > rpc::status_codes::overloaded)
+			++result.invalid;
+		else if (status != rpc::status_codes::good)
+			++result.errors;
+	}
+
+	// reads the frames that arrived without blocking (a readable socket may hold control frames only),
+	// stream data is consumed right away so the server keeps its credit
+	bool receive_arrived(rpc::channel& link, misc::buffer<>& payload, connection_result& result)
+	{
+		if (!link.poll())
+			return false;
+		while (link.has_pending()) {
+			rpc::frame_header header;
+			if (!link.receive(header, payload))
+				return false;
+			++result.received;
+			count_reply(header, payload, result);
+			if ((header.flags & rpc::frame_flags::stream_chunk) && !link.consume(header.size))
+				return false;
+		}
+		return true;
+	}
+
+	void replay_connection(const options& settings, const std::vector<rpc::captured_frame>& frames,
+		clock::time_point start, connection_result& result)
+	{
+		net::socket<net::protocols::TCP> socket = {};
+		if (!socket.create({ settings.host.c_str(), settings.port }) || !socket.connect())
+			return;
+		result.connected = true;
+		net::set_no_delay(socket.native_handle());
+		const std::atomic<rpc::flow_control_policy> policy = rpc::flow_control_policy{};
+		rpc::channel link(socket, policy);
+		if (!link.announce_window()) {
+			result.failed = true;
+			socket.close();
+			return;
+		}
+
+		misc::buffer<> payload;
+		for (const rpc::captured_frame& captured : frames) {
+			const clock::time_point scheduled = start + std::chrono::duration_cast<clock::duration>(
+				std::chrono::nanoseconds(static_cast<std::int64_t>(settings.speed > 0 ? captured.time / settings.speed : 0)));
+			// replies that arrived meanwhile are read, so the server is never blocked sending them
+			if (!receive_arrived(link, payload, result)) {
+				result.failed = true;
+				break;
+			}
+			wait_until(scheduled);
+			result.lag.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - scheduled));
+
+			misc::buffer<> frame = rpc::make_frame(captured.payload.size());
+			frame.add(captured.payload);
+			rpc::header_of(frame) = captured.header;
+			const bool sent = (captured.header.flags & rpc::frame_flags::stream_chunk)
+				? link.send_data(captured.header.call_id, frame.data(), frame.size(), captured.header.size)
+				: link.send(frame.data(), frame.size());
+			if (!sent) {
+				result.failed = true;
+				break;
+			}
+			++result.sent;
+		}
+		const auto drain = std::chrono::duration_cast<std::chrono::microseconds>(settings.drain);
+		while (!result.failed && link.wait(drain) == 0) {
+			if (!receive_arrived(link, payload, result))
+				break;
+		}
+		socket.close();
+	}
+
+	int run(const options& settings)
+	{
+		capture_t frames;
+		std::uint64_t count = 0;
+		std::uint64_t duration = 0;
+		if (!load(settings.capture, frames, count, duration))
+			return 1;
+		if (frames.empty()) {
+			std::cerr << "No frames in " << settings.capture << '\n';
+			return 1;
+		}
+
+		std::vector<connection_result> results(frames.size());
+		std::vector<std::thread> connections;
+		// connections are opened before the clock starts
+		const clock::time_point start = clock::now() + std::chrono::milliseconds(200);
+		std::size_t i = 0;
+		for (const auto& [connection, captured] : frames)
+			connections.emplace_back(replay_connection, std::cref(settings), std::cref(captured), start, std::ref(results[i++]));
+		for (std::thread& connection : connections)
+			connection.join();
+		const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+		connection_result total;
+		std::size_t connected = 0;
+		std::size_t failed = 0;
+		for (const connection_result& result : results) {
+			connected += result.connected;
+			failed += result.failed;
+			total.sent += result.sent;
+			total.received += result.received;
+			total.errors += result.errors;
+			total.invalid += result.invalid;
+			total.lag.merge(result.lag);
+		}
+		if (connected == 0) {
+			std::cerr << "Failed to connect to " << settings.host << ':' << settings.port << '\n';
+			return 1;
+		}
+
+		std::ofstream file;
+		if (!settings.output.empty())
+			file.open(settings.output);
+		std::ostream& output = settings.output.empty() ? std::cout : file;
+		output << "{\n\t\"capture\": \"" << settings.capture << "\",\n"
+			<< "\t\"speed\": " << settings.speed << ",\n"
+			<< "\t\"captured_frames\": " << count << ",\n"
+			<< "\t\"captured_duration_s\": " << duration / 1e9 << ",\n"
+			<< "\t\"connections\": " << connected << ",\n"
+			<< "\t\"failed_connections\": " << failed << ",\n"
+			<< "\t\"sent_frames\": " << total.sent << ",\n"
+			<< "\t\"received_frames\": " << total.received << ",\n"
+			<< "\t\"error_replies\": " << total.errors << ",\n"
+			<< "\t\"invalid_replies\": " << total.invalid << ",\n"
+			// including the drain at the end
+			<< "\t\"elapsed_s\": " << elapsed << ",\n"
+			<< "\t\"lag_us\": { \"p50\": " << total.lag.percentile(0.5) / 1000.0
+			<< ", \"p99\": " << total.lag.percentile(0.99) / 1000.0
+			<< ", \"max\": " << total.lag.max() / 1000.0 << " }\n}\n";
+		if (!output) {
+			std::cerr << "Failed to write " << settings.output << '\n';
+			return 1;
+		}
+		return failed == 0 ? 0 : 1;
+	}
+
+	bool parse(int argc, char** argv, options& settings)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string_view argument = argv[i];
+			if (argument.substr(0, 2) != "--") {
+				if (!settings.capture.empty())
+					return false;
+				settings.capture = argument;
+				continue;
+			}
+			if (i + 1 >= argc)
+				return false;
+			const std::string value = argv[++i];
+			if (argument == "--host")
+				settings.host = value;
+			else if (argument == "--port")
+				settings.port = static_cast<std::uint16_t>(std::stoi(value));
+			else if (argument == "--speed")
+				settings.speed = std::stod(value);
+			else if (argument == "--drain")
+				settings.drain = std::chrono::milliseconds(std::stoll(value));
+			else if (argument == "--output")
+				settings.output = value;
+			else
+				return false;
+		}
+		return !settings.capture.empty() && settings.speed >= 0;
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	replay::options settings;
+	if (!replay::parse(argc, argv, settings)) {
+		std::cerr << "usage: rpc_replay <capture file> [--host <ip>] [--port <port>] [--speed <factor>] [--drain <ms>]"
+			" [--output <file.json>]\n";
+		return 1;
+	}
+	return replay::run(settings);
+}
\ No newline at end of file
@@ -83,9 +83,9 @@ int main()
 	auto server_part = []()
 	{
 		rpc::server server({ "127.0.0.1", rpc::default_port }, // port can be set to an arbitrary one
-			std::pair{ "add", calculator::add },
-			std::pair{ "sum", vector_sum},
-			std::pair{ "t", calculator::do_tuple }
+			std::pair{ "add", &calculator::add },
+			std::pair{ "sum", &vector_sum },
+			std::pair{ "t", &calculator::do_tuple }
 		);
 
 		server.register_type("PC", &password_cracker::creator);
@@ -144,17 +144,17 @@ void first_lab()
 	auto server_part = []()
 	{
 		rpc::server server({ "127.0.0.1", rpc::default_port }, // port can be set to an arbitrary one
-			std::pair{ "+", calculator::add },
-			std::pair{ "-", calculator::sub },
-			std::pair{ "*", calculator::mul },
-			std::pair{ "/", calculator::div }
+			std::pair{ "+", &calculator::add },
+			std::pair{ "-", &calculator::sub },
+			std::pair{ "*", &calculator::mul },
+			std::pair{ "/", &calculator::div }
 		);
 		server.run();
 	};
 	std::thread server_thread(server_part);
 	server_thread.join();
 
-	auto client_part = []() {
+	[[maybe_unused]] auto client_part = []() {
 		std::string ip;
 		std::cout << "Enter ip address of the remote server, please: ";
 		std::cin >> ip;
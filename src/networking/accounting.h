@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// opt-in counting of heap allocations and copied bytes, per thread. Built with RPC_ACCOUNTING
+// every operator new of the process is counted (miscellaneous.cpp replaces it, so it has to be linked)
+// and so are the bytes misc::buffer and misc::get copy; without it the hooks compile to nothing
+namespace misc
+{
+	namespace accounting
+	{
+
+		struct counters
+		{
+			std::uint64_t allocations = 0;
+			std::uint64_t allocated_bytes = 0;
+			std::uint64_t copied_bytes = 0;
+
+			counters& operator+=(const counters& other)
+			{
+				allocations += other.allocations;
+				allocated_bytes += other.allocated_bytes;
+				copied_bytes += other.copied_bytes;
+				return *this;
+			}
+			counters operator-(const counters& other) const
+			{
+				return { allocations - other.allocations, allocated_bytes - other.allocated_bytes, copied_bytes - other.copied_bytes };
+			}
+			bool operator==(const counters&) const = default;
+		};
+
+#if defined(RPC_ACCOUNTING)
+		constexpr bool enabled = true;
+
+		namespace detail
+		{
+			// constant initialized, so it can be touched from operator new at any point of a thread's life
+			inline thread_local counters current;
+		}
+
+		inline void count_allocation(std::size_t bytes)
+		{
+			++detail::current.allocations;
+			detail::current.allocated_bytes += bytes;
+		}
+		inline void count_copy(std::size_t bytes) { detail::current.copied_bytes += bytes; }
+		// totals of the calling thread since it started
+		inline counters thread_counters() { return detail::current; }
+#else
+		constexpr bool enabled = false;
+
+		inline void count_allocation(std::size_t) {}
+		inline void count_copy(std::size_t) {}
+		inline counters thread_counters() { return {}; }
+#endif
+
+		// what the calling thread allocated and copied while the scope was alive, e.g.
+		//   misc::accounting::scope measured;
+		//   client.call_function(...);
+		//   assert(measured.counted().allocations == 0);
+		class scope
+		{
+		private:
+			counters m_start;
+
+		public:
+			scope() : m_start(thread_counters()) {}
+
+			counters counted() const { return thread_counters() - m_start; }
+			void restart() { m_start = thread_counters(); }
+		};
+
+	}
+}
\ No newline at end of file
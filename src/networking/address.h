@@ -1,6 +1,5 @@
 #pragma once
 
-#include <ws2tcpip.h>
 #include <string>
 #include <cassert>
 
@@ -8,8 +7,8 @@
 
 namespace net {
 	namespace IPv {
-		using IPv4 = IN_ADDR;
-		using IPv6 = IN6_ADDR;
+		using IPv4 = in_addr;
+		using IPv6 = in6_addr;
 	}
 
 	template<typename version = IPv::IPv4>
@@ -63,13 +62,13 @@ namespace net {
 
 		uint8_t& operator[](uint8_t byte)
 		{
-			assert(byte < 3 || "IPv4 address has only 4 octets");
-			return ((uint8_t*)(&m_ip.S_un.S_un_b))[byte];
+			assert(byte < 4 && "IPv4 address has only 4 octets");
+			return reinterpret_cast<uint8_t*>(&m_ip.s_addr)[byte];
 		}
 		const uint8_t& operator[](uint8_t byte) const
 		{
-			assert(byte < 3 || "IPv4 address has only 4 octets");
-			return ((uint8_t*)(&m_ip.S_un.S_un_b))[byte];
+			assert(byte < 4 && "IPv4 address has only 4 octets");
+			return reinterpret_cast<const uint8_t*>(&m_ip.s_addr)[byte];
 		}
 
 		bool operator==(const address& address) const {
@@ -78,17 +77,11 @@ namespace net {
 
 		explicit operator sockaddr_in() const
 		{
-			return { AF_INET, m_port, m_ip };
-		}
-		explicit operator sockaddr* () const
-		{
-			sockaddr_in addr = { AF_INET, m_port, m_ip };
-			return (sockaddr*)&addr;
-		}
-		explicit operator const sockaddr* () const
-		{
-			sockaddr_in addr = { AF_INET, m_port, m_ip };
-			return (const sockaddr*)&addr;
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = m_port;
+			addr.sin_addr = m_ip;
+			return addr;
 		}
 	};
 
@@ -122,18 +115,22 @@ namespace net {
 
 		uint8_t& operator[](uint8_t byte)
 		{
-			assert(byte < 15 || "IPv6 address has only 16 octets");
-			return m_ip.u.Byte[byte];
+			assert(byte < 16 && "IPv6 address has only 16 octets");
+			return reinterpret_cast<uint8_t*>(&m_ip)[byte];
 		}
 		const uint8_t& operator[](uint8_t byte) const
 		{
-			assert(byte < 15 || "IPv6 address has only 16 octets");
-			return m_ip.u.Byte[byte];
+			assert(byte < 16 && "IPv6 address has only 16 octets");
+			return reinterpret_cast<const uint8_t*>(&m_ip)[byte];
 		}
 
 		explicit operator sockaddr_in6() const
 		{
-			return { AF_INET6, m_port, 0, m_ip, 0 };
+			sockaddr_in6 addr = {};
+			addr.sin6_family = AF_INET6;
+			addr.sin6_port = m_port;
+			addr.sin6_addr = m_ip;
+			return addr;
 		}
 	};
 }
\ No newline at end of file
@@ -1 +1,84 @@
-#include "miscellaneous.h"
\ No newline at end of file
+#include "miscellaneous.h"
+
+#if defined(RPC_ACCOUNTING)
+#include <cstdlib>
+
+// every allocation of the process is counted for the thread making it
+namespace
+{
+	void* allocate(std::size_t size)
+	{
+		misc::accounting::count_allocation(size);
+		return std::malloc(size ? size : 1);
+	}
+	void* allocate(std::size_t size, std::align_val_t alignment)
+	{
+		misc::accounting::count_allocation(size);
+		const std::size_t align = static_cast<std::size_t>(alignment);
+#if defined(_MSC_VER)
+		return ::_aligned_malloc(size ? size : 1, align);
+#else
+		// aligned_alloc wants a multiple of the alignment
+		return std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+	}
+	void release_aligned(void* data)
+	{
+#if defined(_MSC_VER)
+		::_aligned_free(data);
+#else
+		std::free(data);
+#endif
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	if (void* data = allocate(size))
+		return data;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return allocate(size);
+}
+void operator delete(void* data) noexcept { std::free(data); }
+void operator delete[](void* data) noexcept { std::free(data); }
+void operator delete(void* data, std::size_t) noexcept { std::free(data); }
+void operator delete[](void* data, std::size_t) noexcept { std::free(data); }
+void operator delete(void* data, const std::nothrow_t&) noexcept { std::free(data); }
+void operator delete[](void* data, const std::nothrow_t&) noexcept { std::free(data); }
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (void* data = allocate(size, alignment))
+		return data;
+	throw std::bad_alloc();
+}
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocate(size, alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocate(size, alignment);
+}
+void operator delete(void* data, std::align_val_t) noexcept { release_aligned(data); }
+void operator delete[](void* data, std::align_val_t) noexcept { release_aligned(data); }
+void operator delete(void* data, std::size_t, std::align_val_t) noexcept { release_aligned(data); }
+void operator delete[](void* data, std::size_t, std::align_val_t) noexcept { release_aligned(data); }
+void operator delete(void* data, std::align_val_t, const std::nothrow_t&) noexcept { release_aligned(data); }
+void operator delete[](void* data, std::align_val_t, const std::nothrow_t&) noexcept { release_aligned(data); }
+#endif
\ No newline at end of file
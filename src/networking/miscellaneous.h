@@ -5,9 +5,13 @@
 #include <vector>
 #include <cassert>
 #include <bit>
+#include <algorithm>
+#include <span>
 
 #include <new>
 
+#include "accounting.h"
+
 namespace misc
 {
 
@@ -39,9 +43,9 @@ namespace misc
 	std::size_t sizeof_v(const T& value)
 	{
 		if constexpr (misc::is_iterable<T>::value) {
-			return sizeof T::size_type + value.size() * sizeof T::value_type;
+			return sizeof(typename T::size_type) + value.size() * sizeof(typename T::value_type);
 		}
-		return sizeof T;
+		return sizeof(T);
 	}
 	template<typename T, typename ...Args>
 	std::size_t sizeof_v(const T& value, const Args&... values)
@@ -49,13 +53,27 @@ namespace misc
 		return sizeof_v(value) + sizeof_v(values...);
 	}
 
+	// values encoded with a size known at compile time, containers carry their length
+	template<typename ...Args>
+	constexpr bool is_fixed_size_v = (!is_iterable<std::decay_t<Args>>::value && ...);
+
+	// bytes buffer::add writes for the values, a constant when none of them is a container
+	template<typename ...Args>
+	constexpr std::size_t encoded_size(const Args&... values)
+	{
+		if constexpr (is_fixed_size_v<Args...>)
+			return (std::size_t(0) + ... + sizeof(std::decay_t<Args>));
+		else
+			return (std::size_t(0) + ... + sizeof_v(values));
+	}
+
 	template<typename T, typename offset_t>
 	T get(const void* from, offset_t&& offset)
 	{
 		using decayed = std::decay_t<T>;
 		if constexpr (!std::is_rvalue_reference_v<offset_t>) {
-			offset += sizeof decayed;
-			return *(decayed*)(&((uint8_t*)from)[offset - sizeof T]);
+			offset += sizeof(decayed);
+			return *(decayed*)(&((uint8_t*)from)[offset - sizeof(T)]);
 		}
 		else {
 			return *(decayed*)(&((uint8_t*)from)[offset]);
@@ -67,6 +85,7 @@ namespace misc
 		void* data = new(std::nothrow) std::uint8_t[size];
 		if (data) {
 			std::memcpy(data, static_cast<const std::byte*>(from) + offset, size);
+			accounting::count_copy(size);
 			if constexpr (!std::is_rvalue_reference_v<offset_t>)
 				offset += size;
 		}
@@ -78,7 +97,7 @@ namespace misc
 	{
 		*(T*)((uint8_t*)to + offset) = value;
 		if constexpr (!std::is_rvalue_reference_v<offset_t>)
-			offset += sizeof T;
+			offset += sizeof(T);
 	}
 
 	template<typename T, typename ...Args, typename offset_t>
@@ -86,7 +105,7 @@ namespace misc
 	{
 		*(T*)((uint8_t*)to + offset) = value;
 		if constexpr (!std::is_rvalue_reference_v<offset_t>)
-			offset += sizeof T;
+			offset += sizeof(T);
 		set(to, offset, values...);
 	}
 	template<typename offset_t>
@@ -96,11 +115,84 @@ namespace misc
 	}
 
 
-	template<std::size_t capacity = 0>
+	// decoding of a value written by buffer::add: a container is the number of its bytes (size_t)
+	// followed by the elements, anything else its bytes. Elements are copied once, straight from data,
+	// and reading stops at size
+	template<typename T>
+	T decode(const std::uint8_t* data, std::size_t size)
+	{
+		if constexpr (misc::is_container<T>::value) {
+			using value_type = typename T::value_type;
+			if (size < sizeof(std::size_t))
+				return T();
+			const std::size_t bytes = std::min(get<std::size_t>(data, 0), size - sizeof(std::size_t));
+			const value_type* first = reinterpret_cast<const value_type*>(data + sizeof(std::size_t));
+			accounting::count_copy(bytes);
+			return T(first, first + bytes / sizeof(value_type));
+		}
+		else {
+			T value{};
+			std::memcpy(&value, data, std::min(sizeof(T), size));
+			accounting::count_copy(std::min(sizeof(T), size));
+			return value;
+		}
+	}
+
+	// into a container kept by the caller, which allocates only if its capacity is too small
+	template<typename Container>
+	void decode_into(const std::uint8_t* data, std::size_t size, Container& out)
+	{
+		if constexpr (misc::is_container<Container>::value) {
+			using value_type = typename Container::value_type;
+			if (size < sizeof(std::size_t)) {
+				out.clear();
+				return;
+			}
+			const std::size_t bytes = std::min(get<std::size_t>(data, 0), size - sizeof(std::size_t));
+			const value_type* first = reinterpret_cast<const value_type*>(data + sizeof(std::size_t));
+			accounting::count_copy(bytes);
+			out.assign(first, first + bytes / sizeof(value_type));
+		}
+		else {
+			out = decode<Container>(data, size);
+		}
+	}
+
+	// fills out with the elements of a container, returns how many the container holds;
+	// only the first out.size() of them are copied
+	template<typename T>
+	std::size_t decode_into(const std::uint8_t* data, std::size_t size, std::span<T> out)
+	{
+		if (size < sizeof(std::size_t))
+			return 0;
+		const std::size_t count = std::min(get<std::size_t>(data, 0), size - sizeof(std::size_t)) / sizeof(T);
+		const std::size_t copied = std::min(count, out.size());
+		std::memcpy(out.data(), data + sizeof(std::size_t), copied * sizeof(T));
+		accounting::count_copy(copied * sizeof(T));
+		return count;
+	}
+
+	// writes the elements of a container, read as T, to out and returns it past the last one
+	template<typename T, typename OutputIt>
+	OutputIt decode_elements(const std::uint8_t* data, std::size_t size, OutputIt out)
+	{
+		if (size < sizeof(std::size_t))
+			return out;
+		const std::size_t count = std::min(get<std::size_t>(data, 0), size - sizeof(std::size_t)) / sizeof(T);
+		for (std::size_t i = 0; i < count; ++i) {
+			T value;
+			std::memcpy(&value, data + sizeof(std::size_t) + i * sizeof(T), sizeof(T));
+			*out++ = value;
+		}
+		accounting::count_copy(count * sizeof(T));
+		return out;
+	}
+
+	template<std::size_t fixed_capacity = 0>
 	class buffer
 	{
 	private:
-		std::uint8_t m_data[capacity];
+		std::uint8_t m_data[fixed_capacity];
 		std::size_t m_size = 0;
 	public:
 		buffer() {}
@@ -109,23 +201,29 @@ namespace misc
 		void add(const T& value, const Args&... values)
 		{
 			*(T*)(m_data + m_size) = value;
-			m_size += sizeof T;
+			m_size += sizeof(T);
 			add(values...);
 		}
 		void add() { }
 
 		const std::uint8_t* data() const { return m_data; }
-		std::size_t capacity() const { return capacity; }
+		std::size_t capacity() const { return fixed_capacity; }
 		std::size_t size() const { return m_size; }
 	};
 
 	template<>
 	class buffer<>
 	{
+	public:
+		// capacities up to this are stored inside the buffer instead of the heap,
+		// frames of calls with a few fixed-size arguments and their replies fit
+		static constexpr std::size_t inline_capacity = 64;
+
 	private:
 		std::uint8_t* m_data = nullptr;
 		std::size_t m_size = 0;
 		std::size_t m_capacity = 0;
+		std::uint8_t m_inline[inline_capacity];
 	public:
 		// create must be called
 		buffer() {}
@@ -139,82 +237,80 @@ namespace misc
 		{}
 		buffer(const buffer& buffer)
 		{
-			if (buffer.m_capacity > 0) {
-				delete[] m_data;
-				m_size = buffer.m_size;
-				m_capacity = buffer.m_capacity;
-
-				if (buffer.m_size > 0) {
-					this->m_data = new std::uint8_t[buffer.m_size];
-					std::memcpy(this->m_data, buffer.m_data, buffer.m_size);
-				}
-			}
+			copy(buffer);
 		}
 		buffer& operator=(const buffer& buffer)
 		{
-			if (buffer.m_capacity > 0) {
-				delete[] m_data;
-				m_size = buffer.m_size;
-				m_capacity = buffer.m_capacity;
-
-				if (buffer.m_size > 0) {
-					this->m_data = new std::uint8_t[buffer.m_size];
-					std::memcpy(this->m_data, buffer.m_data, buffer.m_size);
-				}
+			if (this != &buffer) {
+				release();
+				copy(buffer);
 			}
 			return *this;
 		}
 		buffer(buffer&& buffer) noexcept
 		{
-			delete[] m_data;
-
-			m_data = buffer.m_data;
-			m_size = buffer.m_size;
-			m_capacity = buffer.m_capacity;
-
-			buffer.m_data = nullptr;
-			buffer.m_size = 0;
-			buffer.m_capacity = 0;
+			take(buffer);
 		}
 		buffer& operator=(buffer&& buffer) noexcept
 		{
-			delete[] m_data;
-
-			m_data = buffer.m_data;
-			m_size = buffer.m_size;
-			m_capacity = buffer.m_capacity;
-
-			buffer.m_data = nullptr;
-			buffer.m_size = 0;
-			buffer.m_capacity = 0;
+			if (this != &buffer) {
+				release();
+				take(buffer);
+			}
 			return *this;
 		}
 		~buffer()
 		{
-			delete[] m_data;
+			release();
 		}
 		bool create(size_t capacity)
 		{
-			m_capacity = capacity;
-			m_data = new (std::nothrow)std::uint8_t[m_capacity];
+			release();
+			if (capacity <= inline_capacity) {
+				m_data = m_inline;
+				m_capacity = inline_capacity;
+				return true;
+			}
+			m_data = new (std::nothrow)std::uint8_t[capacity];
+			m_capacity = m_data ? capacity : 0;
 			return !!m_data;
 		}
+		// grows capacity keeping stored bytes, never shrinks
+		bool reserve(std::size_t capacity)
+		{
+			if (capacity <= m_capacity)
+				return true;
+			std::uint8_t* data = (capacity <= inline_capacity) ? m_inline : new (std::nothrow) std::uint8_t[capacity];
+			if (!data)
+				return false;
+			if (m_size > 0) {
+				std::memcpy(data, m_data, m_size);
+				accounting::count_copy(m_size);
+			}
+			if (!is_inline())
+				delete[] m_data;
+			m_data = data;
+			m_capacity = (data == m_inline) ? inline_capacity : capacity;
+			return true;
+		}
 		template<typename T, typename ...Args>
 		std::enable_if_t<!std::is_pointer_v<T>> add(const T& value, const Args&... values)
 		{
 			assert(m_size + sizeof_v(value) <= m_capacity && "Out of range error");
 			if constexpr (misc::is_iterable<T>::value) {
 				// adding size of data
-				const std::size_t size = value.size() * sizeof T::value_type;
-				std::memcpy(m_data + m_size, &size, sizeof std::size_t);
-				m_size += sizeof std::size_t;
+				const std::size_t size = value.size() * sizeof(typename T::value_type);
+				std::memcpy(m_data + m_size, &size, sizeof(std::size_t));
+				m_size += sizeof(std::size_t);
 				// adding data itself
 				std::memcpy(m_data + m_size, value.data(), size);
 				m_size += size;
+				accounting::count_copy(sizeof(std::size_t) + size);
 			}
 			if constexpr (!misc::is_iterable<T>::value) {
 				*(T*)(m_data + m_size) = value;
-				m_size += sizeof T;
+				m_size += sizeof(T);
+				accounting::count_copy(sizeof(T));
 			}
 			add(values...);
 		}
@@ -223,6 +319,7 @@ namespace misc
 			assert(m_size + size <= m_capacity && "Out of range error");
 			std::memcpy(m_data + m_size, pointer, size);
 			m_size += size;
+			accounting::count_copy(size);
 			add(values...);
 		}
 		void add(const buffer& buffer)
@@ -230,6 +327,7 @@ namespace misc
 			assert(m_size + buffer.m_size <= m_capacity && "Out of range error");
 			std::memcpy(m_data + m_size, buffer.m_data, buffer.m_size);
 			m_size += buffer.m_size;
+			accounting::count_copy(buffer.m_size);
 		}
 		void add() {}
 
@@ -241,7 +339,8 @@ namespace misc
 				m_size = 0;
 				return;
 			}
-			std::memcpy(m_data, m_data + shift, m_size - shift);
+			std::memmove(m_data, m_data + shift, m_size - shift);
+			accounting::count_copy(m_size - shift);
 			m_size -= shift;
 		}
 
@@ -251,23 +350,24 @@ namespace misc
 		bool is_null() const { return m_data == nullptr; }
 
 		template<typename T>
-		T cast()
+		T cast() const
 		{
 			assert(!is_null());
-
-			if constexpr (misc::is_container<T>::value) {
-				std::size_t offset = 0;
-				typename T::size_type size = misc::get<T::size_type>(this->m_data, offset);
-				typename T::value_type* data =
-					static_cast<typename T::value_type*>(misc::get(this->m_data, size, offset));
-				assert(data);
-				T container(data, data + size / sizeof T::value_type);
-				delete[] data;
-				return container;
-			}
-			T value;
-			std::memcpy(&value, m_data, m_size);
-			return value;
+			return decode<T>(m_data, m_size);
+		}
+		// decodes into storage of the caller: a container (reusing its capacity) or any other value
+		template<typename T>
+		void cast_into(T& out) const
+		{
+			assert(!is_null());
+			decode_into(m_data, m_size, out);
+		}
+		// copies the elements of a container into out, returns how many there are
+		template<typename T>
+		std::size_t cast_into(std::span<T> out) const
+		{
+			assert(!is_null());
+			return decode_into(m_data, m_size, out);
 		}
 
 		const std::uint8_t* data() const { return m_data; }
@@ -276,6 +376,46 @@ namespace misc
 		std::size_t size() const { return m_size; }
 
 		void set_size(std::size_t new_size) { m_size = new_size; }
+
+	private:
+		bool is_inline() const { return m_data == m_inline; }
+		void release()
+		{
+			if (!is_inline())
+				delete[] m_data;
+			m_data = nullptr;
+			m_size = 0;
+			m_capacity = 0;
+		}
+		// a buffer that was created gets a copy of the stored bytes
+		void copy(const buffer& buffer)
+		{
+			if (buffer.is_null() || !create(buffer.m_size))
+				return;
+			if (buffer.m_size > 0) {
+				std::memcpy(m_data, buffer.m_data, buffer.m_size);
+				accounting::count_copy(buffer.m_size);
+			}
+			m_size = buffer.m_size;
+		}
+		// heap storage changes hands, inline bytes are copied
+		void take(buffer& buffer)
+		{
+			if (buffer.is_inline()) {
+				std::memcpy(m_inline, buffer.m_inline, buffer.m_size);
+				accounting::count_copy(buffer.m_size);
+				m_data = m_inline;
+			}
+			else {
+				m_data = buffer.m_data;
+			}
+			m_size = buffer.m_size;
+			m_capacity = buffer.m_capacity;
+
+			buffer.m_data = nullptr;
+			buffer.m_size = 0;
+			buffer.m_capacity = 0;
+		}
 	};
 
 } // namespace misc
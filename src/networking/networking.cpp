@@ -1,5 +1,9 @@
 #include "networking.h"
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 
 namespace net
 {
@@ -19,4 +23,238 @@ namespace net
 		return 0;
 #endif
 	}
+	// rounded up, so a short timeout doesn't turn into a busy loop
+	static int to_milliseconds(std::chrono::microseconds timeout)
+	{
+		if (timeout.count() < 0)
+			return -1;
+		return static_cast<int>(std::min<std::int64_t>((timeout.count() + 999) / 1000, std::numeric_limits<int>::max()));
+	}
+	int wait_readable(const socket_t* sockets, std::size_t count, std::chrono::microseconds timeout)
+	{
+		// poll takes any handle value, select is limited to handles below FD_SETSIZE;
+		// callers wait on a few sockets, more than that costs an allocation
+		const std::size_t inline_count = 8;
+		pollfd inline_entries[inline_count];
+		std::vector<pollfd> entries;
+		pollfd* polled = inline_entries;
+		if (count > inline_count) {
+			entries.resize(count);
+			polled = entries.data();
+		}
+		for (std::size_t i = 0; i < count; ++i)
+			polled[i] = { sockets[i], POLLIN, 0 };
+
+		const int milliseconds = to_milliseconds(timeout);
+#if PLATFORM == PLATFORM_WINDOWS
+		const int result = ::WSAPoll(polled, static_cast<ULONG>(count), milliseconds);
+#else
+		const int result = ::poll(polled, static_cast<nfds_t>(count), milliseconds);
+#endif
+		if (result < 0)
+			return -2;
+
+		// a closed or broken socket is reported readable, its receive then fails
+		for (std::size_t i = 0; result > 0 && i < count; ++i) {
+			if (polled[i].revents & POLLNVAL)
+				return -2;
+			if (polled[i].revents & (POLLIN | POLLHUP | POLLERR))
+				return static_cast<int>(i);
+		}
+		return -1;
+	}
+
+#if PLATFORM == PLATFORM_UNIX
+	poller::poller() : m_epoll(::epoll_create1(EPOLL_CLOEXEC)), m_events(64) {}
+	poller::~poller()
+	{
+		if (m_epoll >= 0)
+			::close(m_epoll);
+	}
+	bool poller::is_open() const { return m_epoll >= 0; }
+	bool poller::add(socket_t socket, std::uint64_t key)
+	{
+		// level triggered: a socket with data left unread is reported again by the next wait
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.u64 = key;
+		return ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket, &event) == 0;
+	}
+	void poller::remove(socket_t socket)
+	{
+		epoll_event event = {};
+		::epoll_ctl(m_epoll, EPOLL_CTL_DEL, socket, &event);
+	}
+	int poller::wait(std::vector<std::uint64_t>& ready, std::chrono::microseconds timeout)
+	{
+		ready.clear();
+		const int count = ::epoll_wait(m_epoll, m_events.data(), static_cast<int>(m_events.size()), to_milliseconds(timeout));
+		if (count < 0)
+			return (errno == EINTR) ? 0 : -1;
+		for (int i = 0; i < count; ++i)
+			ready.push_back(m_events[i].data.u64);
+		return count;
+	}
+#else
+	poller::poller() {}
+	poller::~poller() {}
+	bool poller::is_open() const { return true; }
+	bool poller::add(socket_t socket, std::uint64_t key)
+	{
+		m_sockets.push_back({ socket, POLLIN, 0 });
+		m_keys.push_back(key);
+		return true;
+	}
+	void poller::remove(socket_t socket)
+	{
+		for (std::size_t i = 0; i < m_sockets.size(); ++i) {
+			if (m_sockets[i].fd != socket)
+				continue;
+			m_sockets[i] = m_sockets.back();
+			m_keys[i] = m_keys.back();
+			m_sockets.pop_back();
+			m_keys.pop_back();
+			return;
+		}
+	}
+	int poller::wait(std::vector<std::uint64_t>& ready, std::chrono::microseconds timeout)
+	{
+		ready.clear();
+#if PLATFORM == PLATFORM_WINDOWS
+		const int result = ::WSAPoll(m_sockets.data(), static_cast<ULONG>(m_sockets.size()), to_milliseconds(timeout));
+#else
+		const int result = ::poll(m_sockets.data(), static_cast<nfds_t>(m_sockets.size()), to_milliseconds(timeout));
+#endif
+		if (result < 0)
+			return -1;
+		for (std::size_t i = 0; result > 0 && i < m_sockets.size(); ++i) {
+			if (m_sockets[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+				ready.push_back(m_keys[i]);
+		}
+		return static_cast<int>(ready.size());
+	}
+#endif
+
+	bool set_reuse_port(socket_t socket)
+	{
+#if defined(SO_REUSEPORT)
+		int enable = 1;
+		return ::setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) == 0;
+#else
+		return false;
+#endif
+	}
+	bool set_reuse_address(socket_t socket)
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		// SO_REUSEADDR on windows would let another process take over the port
+		(void)socket;
+		return true;
+#else
+		int enable = 1;
+		return ::setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&enable, sizeof(enable)) == 0;
+#endif
+	}
+	bool socket_pair(socket_t (&pair)[2])
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		// no socketpair on windows, the pair is connected through a loopback listener
+		socket_t listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == INVALID_SOCKET)
+			return false;
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+		int address_length = sizeof(address);
+		pair[0] = pair[1] = INVALID_SOCKET;
+		if (::bind(listener, (const sockaddr*)&address, sizeof(address)) == 0
+			&& ::getsockname(listener, (sockaddr*)&address, &address_length) == 0
+			&& ::listen(listener, 1) == 0
+			&& (pair[0] = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) != INVALID_SOCKET
+			&& ::connect(pair[0], (const sockaddr*)&address, sizeof(address)) == 0)
+			pair[1] = ::accept(listener, nullptr, nullptr);
+		::closesocket(listener);
+		if (pair[1] == INVALID_SOCKET) {
+			if (pair[0] != INVALID_SOCKET)
+				::closesocket(pair[0]);
+			return false;
+		}
+		return true;
+#else
+		return ::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0;
+#endif
+	}
+	bool set_no_delay(socket_t socket)
+	{
+		int enable = 1;
+		return ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&enable, sizeof(enable)) == 0;
+	}
+	bool set_busy_poll(socket_t socket, std::chrono::microseconds timeout)
+	{
+#if defined(SO_BUSY_POLL)
+		int value = static_cast<int>(timeout.count());
+		return ::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, (const char*)&value, sizeof(value)) == 0;
+#else
+		return false;
+#endif
+	}
+	void close_socket(socket_t socket)
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		::closesocket(socket);
+#else
+		::close(socket);
+#endif
+	}
+	void shutdown_socket(socket_t socket)
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		::shutdown(socket, SD_BOTH);
+#else
+		::shutdown(socket, SHUT_RDWR);
+#endif
+	}
+	bool send_gather(socket_t socket, const io_slice* slices, std::size_t count)
+	{
+		constexpr std::size_t batch = 64;
+		// first slice not written completely and how much of it is already sent
+		std::size_t index = 0;
+		std::size_t written = 0;
+
+		while (index < count) {
+			std::size_t vectors_count = 0;
+#if PLATFORM == PLATFORM_WINDOWS
+			WSABUF vectors[batch];
+			for (; vectors_count < batch && index + vectors_count < count; ++vectors_count) {
+				const io_slice& slice = slices[index + vectors_count];
+				const std::size_t skip = (vectors_count == 0) ? written : 0;
+				vectors[vectors_count].buf = (CHAR*)slice.data + skip;
+				vectors[vectors_count].len = static_cast<ULONG>(slice.size - skip);
+			}
+			DWORD sent_bytes = 0;
+			if (::WSASend(socket, vectors, static_cast<DWORD>(vectors_count), &sent_bytes, 0, nullptr, nullptr) != 0)
+				return false;
+			std::size_t left = sent_bytes;
+#else
+			iovec vectors[batch];
+			for (; vectors_count < batch && index + vectors_count < count; ++vectors_count) {
+				const io_slice& slice = slices[index + vectors_count];
+				const std::size_t skip = (vectors_count == 0) ? written : 0;
+				vectors[vectors_count].iov_base = (char*)slice.data + skip;
+				vectors[vectors_count].iov_len = slice.size - skip;
+			}
+			const ssize_t sent_bytes = ::writev(socket, vectors, static_cast<int>(vectors_count));
+			if (sent_bytes < 0)
+				return false;
+			std::size_t left = static_cast<std::size_t>(sent_bytes);
+#endif
+			while (index < count && left >= slices[index].size - written) {
+				left -= slices[index].size - written;
+				written = 0;
+				++index;
+			}
+			written += left;
+		}
+		return true;
+	}
 }
\ No newline at end of file
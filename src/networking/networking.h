@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <chrono>
+#include <vector>
 
 #define PLATFORM_WINDOWS 1
 #define PLATFORM_UNIX 2
@@ -19,12 +21,22 @@
 #define NOMINMAX
 #endif
 #include <winsock2.h>
+#include <ws2tcpip.h>
 using socket_t = SOCKET;
 
-#elif PLATFORM == PLATFORM_MAC || PLATFORM_UNIX
+#elif PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#if PLATFORM == PLATFORM_UNIX
+#include <sys/epoll.h>
+#endif
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 using socket_t = int;
 #endif
 
@@ -37,4 +49,75 @@ namespace net
 	constexpr uint64_t terabyte = 1024 * gigabyte;
 	bool initializeSockets();
 	int shutdownSockets();
+
+	// error code of the last failed socket call of this thread
+	inline int last_error()
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		return ::WSAGetLastError();
+#else
+		return errno;
+#endif
+	}
+
+	// piece of memory written by a gather send
+	struct io_slice
+	{
+		const void* data;
+		std::size_t size;
+	};
+
+	// writes all slices with as few system calls as possible (writev / WSASend)
+	bool send_gather(socket_t socket, const io_slice* slices, std::size_t count);
+
+	// waits until one of the sockets has data to read (negative timeout waits forever),
+	// returns index of the first readable socket, -1 on timeout and -2 on error
+	int wait_readable(const socket_t* sockets, std::size_t count, std::chrono::microseconds timeout);
+
+	// waits on many sockets registered once instead of passed with every wait (epoll on linux,
+	// poll or WSAPoll over the registered sockets elsewhere); ready sockets are reported by the key
+	// they were added with, all of them from one wait
+	class poller
+	{
+	private:
+#if PLATFORM == PLATFORM_UNIX
+		int m_epoll = -1;
+		std::vector<epoll_event> m_events;
+#else
+		std::vector<pollfd> m_sockets;
+		std::vector<std::uint64_t> m_keys;
+#endif
+
+	public:
+		poller();
+		~poller();
+		poller(const poller&) = delete;
+		poller& operator=(const poller&) = delete;
+
+		bool is_open() const;
+		// a socket is added once, it must be removed before it is closed
+		bool add(socket_t socket, std::uint64_t key);
+		void remove(socket_t socket);
+		// stores the keys of the readable sockets (or closed or broken ones, whose receive then fails)
+		// into ready, returns how many there are: 0 on timeout, -1 on error; negative timeout waits forever
+		int wait(std::vector<std::uint64_t>& ready, std::chrono::microseconds timeout);
+	};
+
+	// lets several listening sockets bind the same port, the kernel spreads new connections among them;
+	// false where the platform can't do that (the option must be set before bind)
+	bool set_reuse_port(socket_t socket);
+	// lets a listening socket bind a port whose previous connections are still in TIME_WAIT,
+	// so a restarted server doesn't have to wait for them (SO_REUSEADDR, already so on windows)
+	bool set_reuse_address(socket_t socket);
+
+	// two connected sockets, writing to one wakes up a thread waiting in wait_readable on the other
+	bool socket_pair(socket_t (&pair)[2]);
+	// disables Nagle's algorithm, for senders that coalesce small writes themselves
+	bool set_no_delay(socket_t socket);
+	// lets the kernel busy poll the device queue for up to timeout on blocking reads (SO_BUSY_POLL),
+	// false where unsupported
+	bool set_busy_poll(socket_t socket, std::chrono::microseconds timeout);
+	void close_socket(socket_t socket);
+	// wakes up threads blocked on the socket, their calls then fail; it must still be closed
+	void shutdown_socket(socket_t socket);
 }
\ No newline at end of file
@@ -89,9 +89,9 @@ namespace net {
 		bool bind()
 		{
 			if constexpr (is_server_socket == true) {
-				if (::bind(fd, (const sockaddr*)&(server_part::addr), sizeof sockaddr_in) < 0) {
+				if (::bind(fd, (const sockaddr*)&(server_part::addr), sizeof(sockaddr_in)) < 0) {
 					std::cout << "Failed to bind a socket\n";
-					int error = WSAGetLastError();
+					int error = net::last_error();
 					std::cout << "Error code: " << error << '\n';
 					return false;
 				}
@@ -110,7 +110,7 @@ namespace net {
 			sockaddr_in receiver_address = (sockaddr_in)receiver;
 
 			int send_bytes = ::sendto(fd, (const char*)message, size, flags, (const sockaddr*)&receiver_address, sizeof(sockaddr_in));
-			return send_bytes == size;
+			return send_bytes >= 0 && static_cast<size_t>(send_bytes) == size;
 		}
 
 		std::enable_if_t<static_address == true> set_address(const std::string& ip, uint16_t port)
@@ -129,7 +129,7 @@ namespace net {
 		bool send(const void* message, size_t size, int flags = 0) const
 		{
 			int send_bytes = ::sendto(fd, (const char*)message, size, flags, (const sockaddr*)&(address_part::receiver_address), sizeof(sockaddr_in));
-			return send_bytes == size;
+			return send_bytes >= 0 && static_cast<size_t>(send_bytes) == size;
 		}
 
 		std::pair<address<IPv::IPv4>, int> receive(void* buffer, size_t buffer_size, int flags = 0) const
@@ -160,7 +160,6 @@ namespace net {
 				std::cout << "Failed to set non-blocking to socket\n";
 				return false;
 			}
-		}
 #elif PLATFORM == PLATFORM_WINDOWS
 			DWORD non_blocking = 1;
 			if (::ioctlsocket(fd, FIONBIO, &non_blocking) != 0) {
@@ -175,11 +174,7 @@ namespace net {
 
 		void close()
 		{
-#if PLATFORM == PLATFORM_UNIX || PLATFORM == PLATFORM_MAC
-			close(fd);
-#elif PLATFORM == PLATFORM_WINDOWS
-			closesocket(fd);
-#endif
+			close_socket(fd);
 		}
 	}; // class socket
 
@@ -205,7 +200,8 @@ namespace net {
 			create(address);
 		}
 
-		bool create(const address<IPv::IPv4>& address = {})
+		// reuse_port lets other server sockets listen on the same port (see net::set_reuse_port)
+		bool create(const address<IPv::IPv4>& address = {}, bool reuse_port = false)
 		{
 			if ((fd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) <= 0) {
 				std::cout << "Failed to create a socket\n";
@@ -217,6 +213,14 @@ namespace net {
 			if constexpr (is_server_socket == true) {
 				server_part::addr = (sockaddr_in) address;
 				server_part::addr.sin_addr.s_addr = INADDR_ANY;
+				if (!set_reuse_address(fd)) {
+					std::cout << "Failed to reuse the address of a socket\n";
+					return false;
+				}
+				if (reuse_port && !set_reuse_port(fd)) {
+					std::cout << "Failed to share the port of a socket\n";
+					return false;
+				}
 				if (!bind())
 					return false;
 				if (!listen())
@@ -229,9 +233,9 @@ namespace net {
 		bool bind()
 		{
 			if constexpr (is_server_socket == true) {
-				if (::bind(fd, (const sockaddr*)&(server_part::addr), sizeof sockaddr_in) == -1) {
+				if (::bind(fd, (const sockaddr*)&(server_part::addr), sizeof(sockaddr_in)) == -1) {
 					std::cout << "Failed to bind a socket\n";
-					int error = WSAGetLastError();
+					int error = net::last_error();
 					std::cout << "Error code: " << error << '\n';
 					return false;
 				}
@@ -243,7 +247,7 @@ namespace net {
 			if constexpr (is_server_socket == true) {
 				if (::listen(fd, SOMAXCONN) != 0) {
 					std::cout << "Failed to set listening to a socket\n";
-					int error = WSAGetLastError();
+					int error = net::last_error();
 					std::cout << "Error code: " << error << '\n';
 					return false;
 				}
@@ -254,12 +258,12 @@ namespace net {
 		bool accept()
 		{
 			sockaddr_in client_info;
-			int client_info_length = sizeof client_info;
+			socklen_t client_info_length = sizeof(client_info);
 
 			client_socket = ::accept(fd, (struct sockaddr*)&client_info, &client_info_length);
 			if (client_socket < 0) {
 				std::cout << "Something happened while accepting a new client\n";
-				int error = WSAGetLastError();
+				int error = net::last_error();
 				std::cout << "Error code: " << error << '\n';
 				return false;
 			}
@@ -267,11 +271,31 @@ namespace net {
 			return true;
 		}
 
+		// accepts a new client into a separate socket, so several clients can be served at once
+		bool accept(socket<protocols::TCP>& client) const
+		{
+			sockaddr_in client_info;
+			socklen_t client_info_length = sizeof(client_info);
+
+			socket_t handle = ::accept(fd, (struct sockaddr*)&client_info, &client_info_length);
+			if (handle < 0) {
+				std::cout << "Something happened while accepting a new client\n";
+				int error = net::last_error();
+				std::cout << "Error code: " << error << '\n';
+				return false;
+			}
+			client.adopt(handle);
+			return true;
+		}
+
+		// takes ownership of an already connected handle (e.g. returned by accept)
+		void adopt(socket_t handle) { fd = handle; }
+
 		bool connect()
 		{
-			if (::connect(fd, (const sockaddr*)&receiver_address, sizeof receiver_address) < 0) {
+			if (::connect(fd, (const sockaddr*)&receiver_address, sizeof(receiver_address)) < 0) {
 				std::cout << "Something happened while connecting to the server\n";
-				int error = WSAGetLastError();
+				int error = net::last_error();
 				std::cout << "Error code: " << error << '\n';
 				return false;
 			}
@@ -292,7 +316,7 @@ namespace net {
 			else {
 				send_bytes = ::send(fd, (const char*)message, size, flags);
 			}
-			return send_bytes == size;
+			return send_bytes >= 0 && static_cast<size_t>(send_bytes) == size;
 		}
 		int receive(void* buffer, size_t buffer_size, int flags = 0) const
 		{
@@ -305,6 +329,41 @@ namespace net {
 			}
 			return received_bytes;
 		}
+		// keeps receiving until exactly size bytes arrived,
+		// returns false if the connection was closed or broken on the way
+		bool receive_all(void* buffer, size_t size, int flags = 0) const
+		{
+			size_t received = 0;
+			while (received < size) {
+				int received_bytes = receive((char*)buffer + received, size - received, flags);
+				if (received_bytes <= 0)
+					return false;
+				received += received_bytes;
+			}
+			return true;
+		}
+
+		bool send_gather(const net::io_slice* slices, size_t count) const
+		{
+			return net::send_gather(native_handle(), slices, count);
+		}
+
+		// 0 if data is ready to be received, -1 on timeout, -2 on error
+		int wait(std::chrono::microseconds timeout) const
+		{
+			socket_t handle = native_handle();
+			return net::wait_readable(&handle, 1, timeout);
+		}
+
+		socket_t native_handle() const
+		{
+			if constexpr (is_server_socket)
+				return client_socket;
+			else
+				return fd;
+		}
+		// for a server socket the listening one, readable when a client is waiting to be accepted
+		socket_t listening_handle() const { return fd; }
 
 		//specifies size of OS's internal buffer for TCP and UDP
 		//that holds data arrived but not yet recv'ed
@@ -324,7 +383,6 @@ namespace net {
 				std::cout << "Failed to set non-blocking to socket\n";
 				return false;
 			}
-		}
 #elif PLATFORM == PLATFORM_WINDOWS
 			DWORD non_blocking = 1;
 			if (::ioctlsocket(fd, FIONBIO, &non_blocking) != 0) {
@@ -339,11 +397,7 @@ namespace net {
 
 		void close()
 		{
-#if PLATFORM == PLATFORM_UNIX || PLATFORM == PLATFORM_MAC
-			close(fd);
-#elif PLATFORM == PLATFORM_WINDOWS
-			closesocket(fd);
-#endif
+			close_socket(fd);
 		}
 	}; // class socket
 
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "miscellaneous.h"
+
+namespace rpc
+{
+
+	// class of a function or method, waiting calls of a higher class are admitted first
+	using priority_t = std::uint8_t;
+	namespace priorities
+	{
+		// control plane calls that must not wait behind anything else
+		const priority_t critical = 0;
+		const priority_t normal = 1;
+		// data plane calls that may wait
+		const priority_t bulk = 2;
+		const std::size_t count = 3;
+	}
+
+	// bounds the work a server takes on; calls over the limits wait in a bounded queue
+	// and are answered with status_codes::overloaded when it is full or they waited too long
+	struct admission_policy
+	{
+		// calls executed at once over all connections, the adaptive limit moves between min and max
+		std::size_t initial_limit = 64;
+		std::size_t min_limit = 4;
+		std::size_t max_limit = 1024;
+		// calls allowed to wait for a free slot, the rest is rejected right away
+		std::size_t queue_capacity = 256;
+		// queueing delay the limit is tuned for: waiting shorter grows it by one per limit admitted calls,
+		// waiting longer shrinks it by backoff (AIMD)
+		std::chrono::microseconds target_queue_delay = std::chrono::milliseconds(5);
+		double backoff = 0.9;
+		// calls waiting longer than this are rejected even if their deadline is later
+		std::chrono::microseconds max_queue_delay = std::chrono::milliseconds(50);
+		// a waiting call of a lower class is admitted at the latest after this many calls of higher classes
+		// overtook it, so bulk calls are slowed down but never starve
+		std::size_t starvation_limit = 8;
+	};
+
+	struct admission_counters
+	{
+		std::uint64_t admitted = 0;
+		// rejected because the queue was full
+		std::uint64_t rejected = 0;
+		// rejected after waiting for max_queue_delay or until the deadline
+		std::uint64_t timed_out = 0;
+		std::size_t limit = 0;
+		std::size_t running = 0;
+		std::size_t queued = 0;
+	};
+
+	class admission_controller
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		struct method_state
+		{
+			// 0 means the method is limited only by the server wide limit
+			std::size_t limit = 0;
+			std::size_t running = 0;
+			priority_t priority = priorities::normal;
+		};
+
+		// lives on the stack of the waiting thread while it is queued
+		struct waiter
+		{
+			method_state* method;
+			priority_t priority;
+			bool admitted = false;
+		};
+
+		struct lane
+		{
+			std::deque<waiter*> waiters;
+			// admissions of higher lanes since this one was last served while it had waiters
+			std::size_t overtaken = 0;
+		};
+
+		std::mutex m_mutex;
+		std::condition_variable m_released;
+		admission_policy m_policy;
+		double m_limit;
+		std::size_t m_running = 0;
+		std::size_t m_queued = 0;
+		std::unordered_map<id_t, method_state> m_methods;
+		std::array<lane, priorities::count> m_lanes;
+		admission_counters m_counters;
+
+	public:
+		explicit admission_controller(const admission_policy& policy = {})
+			: m_policy(policy), m_limit(static_cast<double>(policy.initial_limit)) {}
+
+		void set_policy(const admission_policy& policy)
+		{
+			std::lock_guard lock(m_mutex);
+			m_policy = policy;
+			m_limit = std::clamp(m_limit, static_cast<double>(policy.min_limit), static_cast<double>(policy.max_limit));
+			admit_waiters();
+		}
+
+		void set_limit(id_t method, std::size_t limit)
+		{
+			std::lock_guard lock(m_mutex);
+			m_methods[method].limit = limit;
+			admit_waiters();
+		}
+
+		void set_priority(id_t method, priority_t priority)
+		{
+			assert(priority < priorities::count);
+			std::lock_guard lock(m_mutex);
+			m_methods[method].priority = priority;
+		}
+
+		// waits for a free slot until the deadline or max_queue_delay, false means the call is rejected;
+		// every admitted call must be released
+		bool acquire(id_t method, clock::time_point deadline)
+		{
+			const auto start = clock::now();
+			std::unique_lock lock(m_mutex);
+			method_state& state = m_methods[method];
+
+			if (m_queued >= m_policy.queue_capacity) {
+				++m_counters.rejected;
+				return false;
+			}
+			// every call is queued, so a free slot goes to the highest lane even if a bulk call asked first
+			waiter self{ &state, state.priority };
+			m_lanes[self.priority].waiters.push_back(&self);
+			++m_queued;
+			admit_waiters();
+
+			const bool admitted = m_released.wait_until(lock, std::min(deadline, start + m_policy.max_queue_delay),
+				[&self]() { return self.admitted; });
+			if (!admitted) {
+				std::erase(m_lanes[self.priority].waiters, &self);
+				--m_queued;
+				++m_counters.timed_out;
+			}
+			adapt(clock::now() - start);
+			return admitted;
+		}
+
+		// for callers that can't wait for a slot, like reactors of a sharded server that serve their
+		// connections one frame at a time: admits the call only if a slot is free right away. waited is how long
+		// the call sat in the backlog of the caller and tunes the limit like a queueing delay; lower classes
+		// are shed first when it grows: bulk calls after target_queue_delay, normal ones after max_queue_delay,
+		// critical ones only when there is no slot. false means the call is rejected
+		bool try_acquire(id_t method, clock::duration waited)
+		{
+			std::lock_guard lock(m_mutex);
+			method_state& state = m_methods[method];
+			adapt(waited);
+
+			const bool too_late = (state.priority == priorities::bulk && waited > m_policy.target_queue_delay)
+				|| (state.priority == priorities::normal && waited > m_policy.max_queue_delay);
+			if (too_late) {
+				++m_counters.timed_out;
+				return false;
+			}
+			if (m_running >= static_cast<std::size_t>(m_limit) || (state.limit != 0 && state.running >= state.limit)) {
+				++m_counters.rejected;
+				return false;
+			}
+			++state.running;
+			++m_running;
+			++m_counters.admitted;
+			return true;
+		}
+
+		void release(id_t method)
+		{
+			std::lock_guard lock(m_mutex);
+			--m_running;
+			--m_methods[method].running;
+			admit_waiters();
+		}
+
+		admission_counters counters()
+		{
+			std::lock_guard lock(m_mutex);
+			admission_counters counters = m_counters;
+			counters.limit = static_cast<std::size_t>(m_limit);
+			counters.running = m_running;
+			counters.queued = m_queued;
+			return counters;
+		}
+
+	private:
+		// hands free slots to queued calls, highest lane first unless a lower one was overtaken too often
+		void admit_waiters()
+		{
+			bool admitted_any = false;
+			while (m_running < static_cast<std::size_t>(m_limit)) {
+				lane* chosen = nullptr;
+				auto runnable = m_lanes[0].waiters.end();
+				for (lane& candidate : m_lanes) {
+					auto it = std::find_if(candidate.waiters.begin(), candidate.waiters.end(), [](const waiter* queued) {
+						return queued->method->limit == 0 || queued->method->running < queued->method->limit;
+					});
+					if (it == candidate.waiters.end())
+						continue;
+					if (!chosen || candidate.overtaken >= m_policy.starvation_limit) {
+						chosen = &candidate;
+						runnable = it;
+					}
+					if (candidate.overtaken >= m_policy.starvation_limit)
+						break;
+				}
+				if (!chosen)
+					break;
+
+				for (lane& other : m_lanes) {
+					if (&other == chosen)
+						other.overtaken = 0;
+					else if (&other > chosen && !other.waiters.empty())
+						++other.overtaken;
+				}
+
+				waiter* next = *runnable;
+				chosen->waiters.erase(runnable);
+				--m_queued;
+				next->admitted = true;
+				++next->method->running;
+				++m_running;
+				++m_counters.admitted;
+				admitted_any = true;
+			}
+			if (admitted_any)
+				m_released.notify_all();
+		}
+
+		void adapt(clock::duration queue_delay)
+		{
+			if (queue_delay <= m_policy.target_queue_delay)
+				m_limit += 1.0 / m_limit;
+			else
+				m_limit *= m_policy.backoff;
+			m_limit = std::clamp(m_limit, static_cast<double>(m_policy.min_limit), static_cast<double>(m_policy.max_limit));
+		}
+	};
+
+	// releases the slot of an admitted call when it goes out of scope
+	class admission_ticket
+	{
+	private:
+		admission_controller* m_controller = nullptr;
+		id_t m_method = null_id;
+
+	public:
+		admission_ticket() {}
+		admission_ticket(admission_controller& controller, id_t method) : m_controller(&controller), m_method(method) {}
+		~admission_ticket()
+		{
+			if (m_controller)
+				m_controller->release(m_method);
+		}
+
+		admission_ticket(const admission_ticket&) = delete;
+		admission_ticket& operator=(const admission_ticket&) = delete;
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../networking/networking.h"
+#include "miscellaneous.h"
+
+namespace rpc
+{
+
+	// result of a call is identified by the function and its serialized arguments
+	struct call_key
+	{
+		id_t function;
+		std::string arguments;
+	};
+	// non-owning form of call_key, lookups with it don't allocate
+	struct call_key_view
+	{
+		id_t function;
+		std::string_view arguments;
+	};
+
+	struct call_key_hash
+	{
+		using is_transparent = void;
+
+		std::size_t operator()(const call_key_view& key) const
+		{
+			std::size_t hash = std::hash<std::string_view>{}(key.arguments);
+			return hash ^ (key.function + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2));
+		}
+		std::size_t operator()(const call_key& key) const
+		{
+			return (*this)(call_key_view{ key.function, key.arguments });
+		}
+	};
+
+	struct call_key_equal
+	{
+		using is_transparent = void;
+
+		template<typename Left, typename Right>
+		bool operator()(const Left& left, const Right& right) const
+		{
+			return left.function == right.function
+				&& std::string_view(left.arguments) == std::string_view(right.arguments);
+		}
+	};
+
+	struct cache_policy
+	{
+		std::size_t max_entries = 1024;
+		std::size_t max_bytes = 16 * net::megabyte;
+		// zero means entries never expire
+		std::chrono::milliseconds ttl = std::chrono::milliseconds(0);
+	};
+
+	struct cache_counters
+	{
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t insertions = 0;
+		std::uint64_t evictions = 0;
+		std::uint64_t expirations = 0;
+	};
+
+	// least recently used cache bounded by number of entries and their total size,
+	// entries optionally expire after ttl; not thread safe
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>>
+	class lru_cache
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		struct entry
+		{
+			Key key;
+			Value value;
+			std::size_t bytes;
+			clock::time_point expires;
+		};
+		using iterator = typename std::list<entry>::iterator;
+
+		// most recently used entries are at the front
+		std::list<entry> m_entries;
+		std::unordered_map<Key, iterator, Hash, Equal> m_index;
+		cache_policy m_policy;
+		std::size_t m_bytes = 0;
+		cache_counters m_counters;
+
+	public:
+		lru_cache(const cache_policy& policy = {}) : m_policy(policy) {}
+
+		// returns nullptr on a miss, the pointer is valid until the next put
+		template<typename K>
+		const Value* find(const K& key)
+		{
+			auto it = m_index.find(key);
+			if (it == m_index.end()) {
+				++m_counters.misses;
+				return nullptr;
+			}
+			if (m_policy.ttl.count() > 0 && clock::now() >= it->second->expires) {
+				erase(it);
+				++m_counters.expirations;
+				++m_counters.misses;
+				return nullptr;
+			}
+			m_entries.splice(m_entries.begin(), m_entries, it->second);
+			++m_counters.hits;
+			return &it->second->value;
+		}
+
+		// bytes is the weight of the entry counted against max_bytes
+		void put(Key key, Value value, std::size_t bytes)
+		{
+			if (bytes > m_policy.max_bytes || m_policy.max_entries == 0)
+				return;
+
+			auto it = m_index.find(key);
+			if (it != m_index.end())
+				erase(it);
+
+			const clock::time_point expires = (m_policy.ttl.count() > 0) ? clock::now() + m_policy.ttl : clock::time_point::max();
+			m_entries.push_front(entry{ std::move(key), std::move(value), bytes, expires });
+			m_index.emplace(m_entries.front().key, m_entries.begin());
+			m_bytes += bytes;
+			++m_counters.insertions;
+
+			while (m_entries.size() > m_policy.max_entries || m_bytes > m_policy.max_bytes) {
+				erase(m_index.find(m_entries.back().key));
+				++m_counters.evictions;
+			}
+		}
+
+		void clear()
+		{
+			m_index.clear();
+			m_entries.clear();
+			m_bytes = 0;
+		}
+
+		std::size_t size() const { return m_entries.size(); }
+		std::size_t bytes() const { return m_bytes; }
+		const cache_counters& counters() const { return m_counters; }
+
+	private:
+		void erase(typename std::unordered_map<Key, iterator, Hash, Equal>::iterator it)
+		{
+			iterator entry = it->second;
+			m_bytes -= entry->bytes;
+			m_index.erase(it);
+			m_entries.erase(entry);
+		}
+	};
+
+}
\ No newline at end of file
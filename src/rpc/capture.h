@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "miscellaneous.h"
+#include "frame.h"
+#include "mpsc_queue.h"
+
+namespace rpc
+{
+
+	// capture file: a capture_file_header, then for every frame a capture_record followed by
+	// the payload of the frame, stored decompressed
+#pragma pack(push, 1)
+	struct capture_file_header
+	{
+		char magic[4] = { 'R', 'P', 'C', 'C' };
+		std::uint32_t version = 1;
+	};
+
+	struct capture_record
+	{
+		// since the capture started
+		std::uint64_t time = 0;
+		// numbered by the server in the order connections were accepted
+		std::uint32_t connection = 0;
+		frame_header header;
+	};
+#pragma pack(pop)
+
+	struct capture_policy
+	{
+		// frames kept in memory until the writer stores them, a power of two;
+		// frames arriving while it is full are dropped, the server never waits for the disk
+		std::size_t capacity = 4096;
+		// how long the writer sleeps when there is nothing to store
+		std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10);
+	};
+
+	struct capture_counters
+	{
+		std::uint64_t recorded = 0;
+		std::uint64_t dropped = 0;
+	};
+
+	// records frames of any thread into a bounded lock-free ring (Vyukov's bounded queue),
+	// a background thread stores them in the file; buffers of the slots are reused, so recording
+	// allocates only until they have grown to the size of the frames
+	class capture_writer
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		struct slot
+		{
+			std::atomic<std::size_t> sequence;
+			misc::buffer<> record;
+		};
+
+		std::unique_ptr<slot[]> m_slots;
+		std::size_t m_mask = 0;
+		alignas(cache_line_size) std::atomic<std::size_t> m_enqueue = 0;
+		alignas(cache_line_size) std::size_t m_dequeue = 0;
+		alignas(cache_line_size) std::atomic<std::uint64_t> m_recorded = 0;
+		std::atomic<std::uint64_t> m_dropped = 0;
+
+		clock::time_point m_start = clock::now();
+		std::atomic<bool> m_running = false;
+		std::ofstream m_file;
+		std::thread m_thread;
+		capture_policy m_policy;
+
+	public:
+		capture_writer() {}
+		~capture_writer() { stop(); }
+		capture_writer(const capture_writer&) = delete;
+		capture_writer& operator=(const capture_writer&) = delete;
+
+		// a writer captures once: threads recording into it may still hold it after stop,
+		// so its ring is never replaced; a new capture takes a new writer
+		bool start(const std::string& path, const capture_policy& policy = {})
+		{
+			if (m_slots)
+				return false;
+			m_policy = policy;
+			m_file.open(path, std::ios::binary | std::ios::trunc);
+			if (!m_file) {
+				std::cout << "Failed to open capture file " << path << '\n';
+				return false;
+			}
+			const capture_file_header header;
+			m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			const std::size_t capacity = std::bit_ceil(std::max<std::size_t>(policy.capacity, 2));
+			m_slots = std::make_unique<slot[]>(capacity);
+			for (std::size_t i = 0; i < capacity; ++i)
+				m_slots[i].sequence.store(i, std::memory_order_relaxed);
+			m_mask = capacity - 1;
+			m_start = clock::now();
+			m_running.store(true, std::memory_order_release);
+			m_thread = std::thread(&capture_writer::write_loop, this);
+			return true;
+		}
+
+		// stores what is still in the ring and closes the file
+		void stop()
+		{
+			if (!m_running.exchange(false, std::memory_order_acq_rel))
+				return;
+			m_thread.join();
+			drain();
+			m_file.close();
+		}
+
+		bool is_running() const { return m_running.load(std::memory_order_relaxed); }
+
+		// called by any thread, false if the frame was dropped
+		bool record(std::uint32_t connection, const frame_header& header, const misc::buffer<>& payload)
+		{
+			if (!m_running.load(std::memory_order_relaxed))
+				return false;
+			const std::uint64_t time = static_cast<std::uint64_t>(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count());
+
+			std::size_t position = m_enqueue.load(std::memory_order_relaxed);
+			slot* target;
+			while (true) {
+				target = &m_slots[position & m_mask];
+				const std::size_t sequence = target->sequence.load(std::memory_order_acquire);
+				const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+				if (difference == 0) {
+					if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (difference < 0) {
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				else {
+					position = m_enqueue.load(std::memory_order_relaxed);
+				}
+			}
+
+			capture_record entry;
+			entry.time = time;
+			entry.connection = connection;
+			entry.header = header;
+			entry.header.size = static_cast<std::uint32_t>(payload.size());
+			misc::buffer<>& record = target->record;
+			record.clear();
+			if (record.reserve(sizeof(entry) + payload.size())) {
+				record.add(entry);
+				record.add(payload);
+			}
+			target->sequence.store(position + 1, std::memory_order_release);
+			m_recorded.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		capture_counters counters() const
+		{
+			return { m_recorded.load(std::memory_order_relaxed), m_dropped.load(std::memory_order_relaxed) };
+		}
+
+	private:
+		// the writer thread is the only consumer, and stop drains only after it has ended
+		bool drain()
+		{
+			bool wrote = false;
+			while (true) {
+				slot& source = m_slots[m_dequeue & m_mask];
+				if (source.sequence.load(std::memory_order_acquire) != m_dequeue + 1)
+					break;
+				// a record that couldn't be reserved is left empty
+				if (!source.record.is_empty())
+					m_file.write(reinterpret_cast<const char*>(source.record.data()), source.record.size());
+				source.sequence.store(m_dequeue + m_mask + 1, std::memory_order_release);
+				++m_dequeue;
+				wrote = true;
+			}
+			return wrote;
+		}
+
+		void write_loop()
+		{
+			while (m_running.load(std::memory_order_acquire)) {
+				if (drain())
+					m_file.flush();
+				else
+					std::this_thread::sleep_for(m_policy.flush_interval);
+			}
+		}
+	};
+
+	// one frame read back from a capture file
+	struct captured_frame
+	{
+		std::uint64_t time = 0;
+		std::uint32_t connection = 0;
+		frame_header header;
+		misc::buffer<> payload;
+	};
+
+	class capture_reader
+	{
+	private:
+		std::ifstream m_file;
+
+	public:
+		bool open(const std::string& path)
+		{
+			m_file.open(path, std::ios::binary);
+			capture_file_header header;
+			const capture_file_header expected;
+			if (!m_file.read(reinterpret_cast<char*>(&header), sizeof(header))
+				|| std::memcmp(header.magic, expected.magic, sizeof(header).magic) != 0 || header.version != expected.version) {
+				std::cout << "Not a capture file: " << path << '\n';
+				return false;
+			}
+			return true;
+		}
+
+		// false at the end of the file or if the file is cut short
+		bool next(captured_frame& frame)
+		{
+			capture_record entry;
+			if (!m_file.read(reinterpret_cast<char*>(&entry), sizeof(entry)) || entry.header.size > max_frame_size)
+				return false;
+			frame.time = entry.time;
+			frame.connection = entry.connection;
+			frame.header = entry.header;
+			frame.payload = misc::buffer<>(std::max<std::size_t>(entry.header.size, 1));
+			if (entry.header.size > 0 && !m_file.read(reinterpret_cast<char*>(frame.payload.data_nc()), entry.header.size))
+				return false;
+			frame.payload.set_size(entry.header.size);
+			return true;
+		}
+	};
+
+}
\ No newline at end of file
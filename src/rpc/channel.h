@@ -0,0 +1,548 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include "../networking/socket.h"
+#include "miscellaneous.h"
+#include "frame.h"
+#include "capture.h"
+
+namespace rpc
+{
+
+	// credit every connection and stream starts with before the receiver grants more
+	const std::int64_t initial_window = 64 * net::kilobyte;
+	// call id of window updates that apply to the whole connection
+	const call_id_t connection_stream = null_call_id;
+	// bytes of call frames a channel reads ahead of the one being handled, e.g. calls pipelined behind
+	// a running one; once reached it stops reading and the kernel buffers hold the peer back.
+	// As much queued stream data gets its credit back while a writer waits for credit
+	const std::size_t pending_limit = 4 * net::megabyte;
+
+	// frames sent in a short burst are written together: the channel collects them
+	// and writes them with a single send once max_bytes are collected, the oldest one waited for
+	// max_delay, or the sender is about to wait for the peer
+	struct batching_policy
+	{
+		bool enabled = false;
+		std::size_t max_bytes = 64 * net::kilobyte;
+		std::chrono::microseconds max_delay = std::chrono::microseconds(20);
+	};
+
+	// trades a core for latency: before blocking, the waiting thread polls the socket
+	// without sleeping for up to spin, and the kernel busy polls the device for kernel_spin
+	struct busy_poll_policy
+	{
+		bool enabled = false;
+		std::chrono::microseconds spin = std::chrono::microseconds(50);
+		// SO_BUSY_POLL, needs CAP_NET_ADMIN to go above net.core.busy_read; zero leaves it alone
+		std::chrono::microseconds kernel_spin = std::chrono::microseconds(0);
+		// cpu the polling thread is pinned to, -1 leaves it unpinned
+		int cpu = -1;
+	};
+
+	// polls the sockets without sleeping until one is readable or spin passes,
+	// returns its index or -1 if none became readable in time
+	inline int spin_readable(const socket_t* sockets, std::size_t count, std::chrono::microseconds spin)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		do {
+			const int ready = net::wait_readable(sockets, count, std::chrono::microseconds(0));
+			if (ready != -1)
+				return ready;
+		} while (std::chrono::steady_clock::now() - start < spin);
+		return -1;
+	}
+
+	// connections whose peer was silent for heartbeat_interval are pinged, which keeps middleboxes from
+	// dropping them and makes the kernel notice a dead peer; a peer silent for idle_timeout,
+	// be it idle or half-open, is disconnected. Zero disables either
+	struct keepalive_policy
+	{
+		std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(0);
+		std::chrono::milliseconds heartbeat_interval = std::chrono::milliseconds(0);
+	};
+
+	// how many bytes of stream data a receiver accepts before the consumer drains them
+	struct flow_control_policy
+	{
+		std::uint32_t connection_window = 4 * net::megabyte;
+		std::uint32_t stream_window = 1 * net::megabyte;
+	};
+
+	// receiver side bookkeeping of one window
+	struct window
+	{
+		// credit the peer still has according to what was received so far
+		std::int64_t available = initial_window;
+		// received but not yet consumed
+		std::int64_t unconsumed = 0;
+
+		// credit to grant so that peer's credit and buffered data stay within size, 0 if not worth it yet
+		std::int64_t grant(std::int64_t size)
+		{
+			const std::int64_t increment = size - available - unconsumed;
+			if (increment < size / 2)
+				return 0;
+			available += increment;
+			return increment;
+		}
+	};
+
+	// frame level view of a connection: spends send credits granted by the peer on stream data
+	// and grants credits back with window updates as received stream data is consumed;
+	// frames arriving while a sender waits for credit are queued for the next receive
+	class channel
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		struct queued_frame
+		{
+			frame_header header;
+			misc::buffer<> payload;
+			clock::time_point arrival;
+		};
+
+		net::socket<net::protocols::TCP> m_socket;
+		const std::atomic<flow_control_policy>* m_policy = nullptr;
+
+		std::int64_t m_connection_credit = initial_window;
+		std::unordered_map<call_id_t, std::int64_t> m_stream_credits;
+		window m_connection_window;
+		std::deque<queued_frame> m_pending;
+		// queued bytes of frames not charged to any window and of stream data
+		std::size_t m_pending_calls = 0;
+		std::size_t m_pending_data = 0;
+		// credit granted for stream data while it was queued, readers deduct it from their next grants
+		std::unordered_map<call_id_t, std::int64_t> m_advanced;
+		clock::time_point m_arrival = {};
+
+		// call being executed, cancel frames for it are remembered instead of dropping queued frames
+		call_id_t m_running = null_call_id;
+		bool m_running_cancelled = false;
+
+		// frames written while corked, flushed at once
+		misc::buffer<> m_output;
+		bool m_corked = false;
+		batching_policy m_batching;
+		clock::time_point m_first_output = {};
+
+		std::chrono::microseconds m_spin = std::chrono::microseconds(0);
+
+		// when the last frame of any kind was read from the socket
+		clock::time_point m_last_receive = clock::now();
+
+		// frames handed on by the channel are recorded here, if set
+		std::shared_ptr<capture_writer> m_capture;
+		std::uint32_t m_capture_connection = 0;
+
+	public:
+		channel() {}
+		// policy is shared with the owner, so windows can be changed at runtime
+		channel(const net::socket<net::protocols::TCP>& socket, const std::atomic<flow_control_policy>& policy)
+			: m_socket(socket), m_policy(&policy) {}
+
+		flow_control_policy policy() const
+		{
+			return m_policy ? m_policy->load(std::memory_order_relaxed) : flow_control_policy{};
+		}
+
+		// grants the peer the part of the connection window exceeding the initial one
+		bool announce_window()
+		{
+			return send_window_update(connection_stream, m_connection_window.grant(policy().connection_window));
+		}
+
+		bool receive(frame_header& header, misc::buffer<>& payload)
+		{
+			// the peer may be waiting for what is still collected here
+			if (m_pending.empty() && !flush())
+				return false;
+			if (!m_pending.empty()) {
+				pop_pending(m_pending.begin(), header, payload);
+				return true;
+			}
+			spin(m_spin);
+			do {
+				if (!receive_frame(m_socket, header, payload))
+					return false;
+			} while (handle_control(header, payload));
+			m_arrival = clock::now();
+			return true;
+		}
+
+		// receives the next frame of the call, frames of other calls read on the way are queued
+		// for receive; fails if they can't be queued anymore, the call's frame would be behind them
+		bool receive_for(call_id_t call_id, frame_header& header, misc::buffer<>& payload)
+		{
+			auto it = std::find_if(m_pending.begin(), m_pending.end(),
+				[call_id](const queued_frame& queued) { return queued.header.call_id == call_id; });
+			if (it != m_pending.end()) {
+				pop_pending(it, header, payload);
+				return true;
+			}
+			if (!flush())
+				return false;
+			spin(m_spin);
+			while (!is_full()) {
+				if (!receive_frame(m_socket, header, payload))
+					return false;
+				if (handle_control(header, payload))
+					continue;
+				if (header.call_id == call_id) {
+					m_arrival = clock::now();
+					return true;
+				}
+				push_pending(queued_frame{ header, std::move(payload), {} });
+			}
+			return false;
+		}
+
+		// when the frame last returned by receive was read from the socket,
+		// deadlines of queued calls count from there
+		clock::time_point arrival() const { return m_arrival; }
+
+		// queues frames that already arrived without blocking, so cancel frames are seen
+		// while a call is executed on the thread owning the channel; with the queue full
+		// they are seen once the calls ahead of them are handled
+		bool poll()
+		{
+			while (!is_full() && m_socket.wait(std::chrono::microseconds(0)) == 0) {
+				queued_frame queued;
+				if (!receive_frame(m_socket, queued.header, queued.payload))
+					return false;
+				if (handle_control(queued.header, queued.payload))
+					continue;
+				push_pending(std::move(queued));
+			}
+			return true;
+		}
+
+		// cancel frames for the call between begin_call and end_call mark it as cancelled,
+		// cancel frames for queued calls remove them before they are dispatched
+		void begin_call(call_id_t call_id)
+		{
+			m_running = call_id;
+			m_running_cancelled = false;
+		}
+		void end_call() { m_running = null_call_id; }
+		bool is_cancelled() const { return m_running_cancelled; }
+
+		// frames without stream data are not flow controlled
+		bool send(const void* data, std::size_t size)
+		{
+			if (!m_corked)
+				return m_socket.send(data, size);
+			const net::io_slice slice = { data, size };
+			return collect(&slice, 1);
+		}
+		bool send_gather(const net::io_slice* slices, std::size_t count)
+		{
+			if (!m_corked)
+				return m_socket.send_gather(slices, count);
+			return collect(slices, count);
+		}
+
+		// until uncork, sends are collected and written together
+		void cork() { m_corked = true; }
+		bool uncork()
+		{
+			m_corked = false;
+			return flush();
+		}
+		bool is_corked() const { return m_corked; }
+
+		// keeps the channel corked between calls and flushes by the policy
+		void set_batching_policy(const batching_policy& policy)
+		{
+			m_batching = policy;
+			m_corked = policy.enabled;
+			if (!m_corked)
+				flush();
+		}
+
+		// waits for frames by polling for up to the policy's spin before blocking
+		void set_busy_poll_policy(const busy_poll_policy& policy)
+		{
+			m_spin = policy.enabled ? policy.spin : std::chrono::microseconds(0);
+			if (policy.enabled && policy.kernel_spin.count() > 0)
+				net::set_busy_poll(m_socket.native_handle(), policy.kernel_spin);
+		}
+
+		// writes everything collected while corked with one send
+		bool flush()
+		{
+			if (m_output.is_empty())
+				return true;
+			const bool sent = m_socket.send(m_output.data(), m_output.size());
+			m_output.clear();
+			return sent;
+		}
+
+		// waits until both the connection and the stream have credit, then spends data_size of it;
+		// gives up once the deadline passes, the call is cancelled or frames read meanwhile can't be queued
+		bool send_data(call_id_t call_id, const void* frame, std::size_t frame_size, std::size_t data_size,
+			clock::time_point deadline = clock::time_point::max())
+		{
+			std::int64_t* stream_credit = nullptr;
+			auto it = m_stream_credits.find(call_id);
+			if (it != m_stream_credits.end())
+				stream_credit = &it->second;
+
+			// a single frame may overdraw the credit, so frames bigger than a window still pass
+			if ((m_connection_credit <= 0 || (stream_credit && *stream_credit <= 0)) && !flush())
+				return false;
+			while (m_connection_credit <= 0 || (stream_credit && *stream_credit <= 0)) {
+				// credit would arrive behind the queued calls
+				if ((call_id == m_running && m_running_cancelled) || is_full())
+					return false;
+				const auto now = clock::now();
+				if (now >= deadline)
+					return false;
+				const std::chrono::microseconds timeout = (deadline == clock::time_point::max())
+					? std::chrono::microseconds(-1) : std::chrono::ceil<std::chrono::microseconds>(deadline - now);
+				const int ready = m_socket.wait(timeout);
+				if (ready == -2)
+					return false;
+				if (ready == -1)
+					continue;
+
+				queued_frame queued;
+				if (!receive_frame(m_socket, queued.header, queued.payload))
+					return false;
+				if (handle_control(queued.header, queued.payload))
+					continue;
+				const frame_header header = queued.header;
+				push_pending(std::move(queued));
+				// the peer may be waiting for credit itself before it reads what is sent here,
+				// so queued stream data is credited as if it was consumed
+				if ((header.flags & frame_flags::stream_chunk) && !advance(header.call_id, header.size))
+					return false;
+			}
+
+			m_connection_credit -= data_size;
+			if (stream_credit)
+				*stream_credit -= data_size;
+			return send(frame, frame_size);
+		}
+
+		// writers of a stream register to have their credit tracked until closed
+		void open_stream(call_id_t call_id) { m_stream_credits.emplace(call_id, initial_window); }
+		void close_stream(call_id_t call_id) { m_stream_credits.erase(call_id); }
+
+		// called by readers once stream data is handed to the consumer
+		bool consume(std::size_t size)
+		{
+			m_connection_window.unconsumed -= size;
+			return send_window_update(connection_stream, m_connection_window.grant(policy().connection_window));
+		}
+
+		// credit granted for the stream's data while it was queued, handed to its reader once
+		std::int64_t take_advanced(call_id_t call_id)
+		{
+			auto it = m_advanced.find(call_id);
+			if (it == m_advanced.end())
+				return 0;
+			const std::int64_t advanced = it->second;
+			m_advanced.erase(it);
+			return advanced;
+		}
+
+		// tells the peer to stop working on the call
+		bool send_cancel(call_id_t call_id)
+		{
+			misc::buffer<> frame = make_frame(0);
+			seal_frame(frame, call_id, frame_flags::cancel);
+			return send(frame.data(), frame.size());
+		}
+
+		// the peer answers with its next read, which counts as a receive on this side
+		bool send_ping()
+		{
+			misc::buffer<> frame = make_frame(0);
+			seal_frame(frame, null_call_id, frame_flags::ping);
+			return send(frame.data(), frame.size());
+		}
+
+		bool send_window_update(call_id_t call_id, std::int64_t increment)
+		{
+			if (increment <= 0)
+				return true;
+			misc::buffer<> frame = make_frame(sizeof(std::uint32_t));
+			frame.add(static_cast<std::uint32_t>(increment));
+			seal_frame(frame, call_id, frame_flags::window_update);
+			return send(frame.data(), frame.size());
+		}
+
+		// 0 if a frame can be received right away, -1 on timeout, -2 on error
+		int wait(std::chrono::microseconds timeout)
+		{
+			if (!m_pending.empty())
+				return 0;
+			if (!flush())
+				return -2;
+			if (m_spin.count() > 0) {
+				const std::chrono::microseconds spin_time = (timeout.count() < 0) ? m_spin : std::min(m_spin, timeout);
+				if (spin(spin_time) == 0)
+					return 0;
+				if (timeout.count() >= 0)
+					timeout -= spin_time;
+			}
+			return m_socket.wait(timeout);
+		}
+		bool has_pending() const { return !m_pending.empty(); }
+		// when the peer last sent anything, pongs and other control frames included
+		clock::time_point last_receive() const { return m_last_receive; }
+		// a frame can be received without blocking, unlike wait this doesn't flush
+		bool is_readable() const { return !m_pending.empty() || m_socket.wait(std::chrono::microseconds(0)) == 0; }
+
+		// records every frame received from now on except the channel's own control frames
+		void set_capture(std::shared_ptr<capture_writer> capture, std::uint32_t connection)
+		{
+			m_capture = std::move(capture);
+			m_capture_connection = connection;
+		}
+
+		const net::socket<net::protocols::TCP>& socket() const { return m_socket; }
+		net::socket<net::protocols::TCP>& socket() { return m_socket; }
+
+	private:
+		bool is_full() const { return m_pending_calls >= pending_limit; }
+
+		std::size_t& pending_bytes(const frame_header& header)
+		{
+			return (header.flags & frame_flags::stream_chunk) ? m_pending_data : m_pending_calls;
+		}
+
+		void push_pending(queued_frame&& queued)
+		{
+			pending_bytes(queued.header) += sizeof(frame_header) + queued.header.size;
+			queued.arrival = clock::now();
+			m_pending.push_back(std::move(queued));
+		}
+
+		void pop_pending(std::deque<queued_frame>::iterator it, frame_header& header, misc::buffer<>& payload)
+		{
+			pending_bytes(it->header) -= sizeof(frame_header) + it->header.size;
+			header = it->header;
+			payload = std::move(it->payload);
+			m_arrival = it->arrival;
+			m_pending.erase(it);
+		}
+
+		// grants the connection and stream credit of queued stream data, as long as queued data stays within the limit
+		bool advance(call_id_t call_id, std::uint32_t size)
+		{
+			if (m_pending_data > pending_limit)
+				return true;
+			m_connection_window.available += size;
+			m_advanced[call_id] += size;
+			return send_window_update(connection_stream, size) && send_window_update(call_id, size) && flush();
+		}
+
+		int spin(std::chrono::microseconds time) const
+		{
+			if (time.count() <= 0)
+				return -1;
+			const socket_t handle = m_socket.native_handle();
+			return spin_readable(&handle, 1, time);
+		}
+
+		bool collect(const net::io_slice* slices, std::size_t count)
+		{
+			std::size_t size = 0;
+			for (std::size_t i = 0; i < count; ++i)
+				size += slices[i].size;
+			if (m_output.size() + size > m_output.capacity()
+				&& !m_output.reserve(std::max(m_output.capacity() * 2, m_output.size() + size)))
+				return false;
+
+			const auto now = clock::now();
+			if (m_output.is_empty())
+				m_first_output = now;
+			for (std::size_t i = 0; i < count; ++i)
+				m_output.add(static_cast<const std::uint8_t*>(slices[i].data), slices[i].size);
+
+			if (m_output.size() >= m_batching.max_bytes || now - m_first_output >= m_batching.max_delay)
+				return flush();
+			return true;
+		}
+
+		// returns true if the frame was meant for the channel itself,
+		// stream data handed on is accounted against the connection window
+		bool handle_control(const frame_header& header, const misc::buffer<>& payload)
+		{
+			m_last_receive = clock::now();
+			if (header.flags & frame_flags::ping) {
+				misc::buffer<> frame = make_frame(0);
+				seal_frame(frame, header.call_id, frame_flags::pong);
+				send(frame.data(), frame.size());
+				return true;
+			}
+			if (header.flags & frame_flags::pong)
+				return true;
+			if (header.flags & frame_flags::window_update) {
+				apply_window_update(header, payload);
+				return true;
+			}
+			if (header.flags & frame_flags::cancel) {
+				apply_cancel(header.call_id);
+				return true;
+			}
+			if (header.flags & frame_flags::stream_chunk) {
+				m_connection_window.available -= header.size;
+				m_connection_window.unconsumed += header.size;
+			}
+			if (m_capture)
+				m_capture->record(m_capture_connection, header, payload);
+			return false;
+		}
+
+		// cancels of calls that already finished are dropped
+		void apply_cancel(call_id_t call_id)
+		{
+			if (call_id == m_running) {
+				m_running_cancelled = true;
+				return;
+			}
+			std::size_t dropped_data = 0;
+			std::erase_if(m_pending, [this, call_id, &dropped_data](const queued_frame& queued) {
+				if (queued.header.call_id != call_id)
+					return false;
+				pending_bytes(queued.header) -= sizeof(frame_header) + queued.header.size;
+				if (queued.header.flags & frame_flags::stream_chunk)
+					dropped_data += queued.header.size;
+				return true;
+			});
+			m_advanced.erase(call_id);
+			// data of dropped frames will never be consumed by a reader
+			if (dropped_data > 0)
+				consume(dropped_data);
+		}
+
+		void apply_window_update(const frame_header& header, const misc::buffer<>& payload)
+		{
+			if (payload.size() < sizeof(std::uint32_t))
+				return;
+			const std::uint32_t increment = misc::get<std::uint32_t>(payload.data(), 0);
+			if (header.call_id == connection_stream) {
+				m_connection_credit += increment;
+				return;
+			}
+			// updates of streams already closed are dropped
+			auto it = m_stream_credits.find(header.call_id);
+			if (it != m_stream_credits.end())
+				it->second += increment;
+		}
+	};
+
+}
\ No newline at end of file
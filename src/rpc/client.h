@@ -5,20 +5,82 @@
 #include "../networking/miscellaneous.h"
 
 #include "miscellaneous.h"
+#include "frame.h"
+#include "statistics.h"
+#include "metrics.h"
+#include "trace.h"
+#include "cache.h"
+#include "stream.h"
+#include "channel.h"
+#include "deadline.h"
+#include "shard.h"
+#include "schema.h"
 
+#include <atomic>
+#include <chrono>
 #include <limits>
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <span>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace rpc
 {
-	template class net::socket<net::protocols::TCP>;
+	// controls when a call to an idempotent function is duplicated to a second replica
+	struct hedging_policy
+	{
+		// hedge is sent once the primary is slower than this percentile of its own latency
+		double percentile = 0.95;
+		// delay used until the endpoint has collected min_samples latencies
+		std::chrono::microseconds initial_delay = std::chrono::milliseconds(10);
+		std::chrono::microseconds min_delay = std::chrono::microseconds(50);
+		std::size_t min_samples = 64;
+		// latency histogram is halved after this many samples so old latencies fade away
+		std::size_t window = 4096;
+	};
+
+	template<typename Signature>
+	class stub;
 
 	class client
 	{
 	private:
-		std::map<handle_t, net::socket<net::protocols::TCP>> sockets;
+		template<typename Signature>
+		friend class stub;
+
+		using clock = deadline_clock;
+
+		struct endpoint
+		{
+			channel link;
+			latency_histogram latency;
+			features_t features = features::none;
+			// what the server registered, empty until fetched
+			std::unordered_map<id_t, schema_entry> schema;
+		};
+
+		std::map<handle_t, endpoint> endpoints;
+		std::set<id_t> idempotent_functions;
+		// declared pure by the user or advertised so by a server
+		std::set<id_t> cacheable_functions;
+		lru_cache<call_key, std::shared_ptr<const misc::buffer<>>, call_key_hash, call_key_equal> results;
+		// arguments of the last lookup, serialized without a frame around them
+		misc::buffer<> memo_key;
+		hedging_policy hedging = {};
+		compression_policy compression = {};
+		std::atomic<flow_control_policy> flow_control = flow_control_policy{};
+		std::chrono::microseconds timeout = std::chrono::microseconds(0);
+		batching_policy batching = {};
+		busy_poll_policy busy_poll = {};
+		call_id_t next_call_id = 0;
+		// handles are numbered per client, they index its endpoints
+		handle_t next_handle = 0;
 		error_t error = errors::no_error;
+		tracer tracing{ "rpc client" };
 	public:
 
 		client() {}
@@ -31,11 +93,130 @@ namespace rpc
 			if (!socket.connect())
 				return null_handle;
 
-			static handle_t server_id = 0;
+			const handle_t server_id = next_handle++;
+
+			// small calls are coalesced by batching (if enabled), not by the kernel
+			net::set_no_delay(socket.native_handle());
+			endpoint& target = endpoints[server_id];
+			target.link = channel(socket, flow_control);
+			target.link.set_batching_policy(batching);
+			target.link.set_busy_poll_policy(busy_poll);
+			if (!target.link.announce_window()) {
+				error = errors::connection_failure;
+				endpoints.erase(server_id);
+				socket.close();
+				return null_handle;
+			}
+			if (compression.enabled)
+				negotiate(server_id);
+			fetch_schema(server_id);
+			return server_id;
+		}
+
+		// table of what the server registered, fetched by connect: calls to functions and methods
+		// listed in it have their arguments checked against the registered signature and are sent
+		// with the 16-bit index in place of the id; calls to anything else still go by id
+		bool fetch_schema(handle_t server_id)
+		{
+			misc::buffer<> reply = call_function(server_id, builtin_functions::schema);
+			if (reply.is_empty())
+				return false;
+			std::unordered_map<id_t, schema_entry>& schema = endpoints[server_id].schema;
+			schema.clear();
+			for (const schema_entry entry : reply.cast<std::vector<schema_entry>>())
+				schema.emplace(entry.id, entry);
+			return true;
+		}
+		// null if the server didn't register id as kind
+		const schema_entry* find_schema(handle_t server_id, id_t id, schema_kind_t kind)
+		{
+			return find_entry(endpoints[server_id], id, kind);
+		}
+
+		// agrees with the server on optional features of the connection, returns the accepted ones
+		features_t negotiate(handle_t server_id)
+		{
+			const features_t requested = compression.enabled ? features::compression : features::none;
+			misc::buffer<> packet = form_packet(opcodes::negotiate, requested);
+			frame_flags_t reply_flags = frame_flags::none;
+			misc::buffer<> buffer = transact(server_id, packet, reply_flags);
+			if (buffer.is_null())
+				return features::none;
+
+			[[maybe_unused]] status_t status = get_call_status(buffer);
+			assert(status == status_codes::good);
+			const features_t accepted = misc::get<features_t>(buffer.data(), 0);
+			endpoints[server_id].features = accepted;
+			return accepted;
+		}
+
+		// takes effect for connections negotiated afterwards
+		void set_compression_policy(const compression_policy& policy) { compression = policy; }
+
+		// windows of all connections follow the new policy with their next window updates
+		void set_flow_control_policy(const flow_control_policy& policy) { flow_control = policy; }
+
+		void set_hedging_policy(const hedging_policy& policy) { hedging = policy; }
+
+		// calls sent shortly one after another leave in one write; a call that nobody waits for
+		// (create_object) may stay collected until the next call, a wait for a reply or flush
+		void set_batching_policy(const batching_policy& policy)
+		{
+			batching = policy;
+			for (auto& [server_id, target] : endpoints)
+				target.link.set_batching_policy(policy);
+		}
+		bool flush(handle_t server_id) { return endpoints[server_id].link.flush(); }
+
+		// replies are polled for up to spin before blocking, the client is used by the calling thread,
+		// so that's the thread pinned to the policy's cpu
+		bool set_busy_poll_policy(const busy_poll_policy& policy)
+		{
+			busy_poll = policy;
+			for (auto& [server_id, target] : endpoints)
+				target.link.set_busy_poll_policy(policy);
+			if (policy.enabled && policy.cpu >= 0)
+				return pin_current_thread(static_cast<std::size_t>(policy.cpu));
+			return true;
+		}
+
+		// calls waiting for a reply longer than this fail with errors::timeout and are cancelled
+		// on the server, which drops them if they did not start yet; zero waits forever
+		void set_timeout(std::chrono::microseconds call_timeout) { timeout = call_timeout; }
+
+		// only calls to idempotent functions are ever hedged
+		void mark_idempotent(std::string_view func_name)
+		{
+			mark_idempotent(std::hash<std::string_view>{}(func_name));
+		}
+		void mark_idempotent(id_t func_id) { idempotent_functions.insert(func_id); }
+
+		const latency_histogram& latency(handle_t server_id) { return endpoints[server_id].latency; }
+
+		// fraction of calls traced through their stages, the trace id travels with the call so the server
+		// traces it too; may be changed between calls
+		void set_trace_sample_rate(double rate) { tracing.set_sample_rate(rate); }
+		// spans of the latest traced calls, tracer::write_chrome_json dumps them
+		tracer& traces() { return tracing; }
+		// what the server recorded about the calls it served, per function, method and type; empty on failure
+		std::vector<metrics_record> server_metrics(handle_t server_id)
+		{
+			misc::buffer<> reply = call_function(server_id, builtin_functions::metrics);
+			if (reply.is_empty())
+				return {};
+			return reply.cast<std::vector<metrics_record>>();
+		}
 
-			sockets.emplace(server_id, socket);
-			return server_id++;
+		// results of pure functions are memoized on the client keyed by the serialized arguments
+		void mark_pure(std::string_view func_name)
+		{
+			mark_pure(std::hash<std::string_view>{}(func_name));
 		}
+		void mark_pure(id_t func_id) { cacheable_functions.insert(func_id); }
+
+		void set_cache_policy(const cache_policy& policy) { results = decltype(results)(policy); }
+		void clear_cache() { results.clear(); }
+		const cache_counters& cache_statistics() const { return results.counters(); }
 
 		template<typename ...Args>
 		misc::buffer<> call_function(handle_t server_id, const std::string_view func_name, const Args&... args)
@@ -52,22 +233,133 @@ namespace rpc
 		template<typename ...Args>
 		misc::buffer<> call_function(handle_t server_id, const id_t func_id, const Args&... args)
 		{
-			misc::buffer<> buffer = form_packet(opcodes::call_function, func_id, args...);
-			if (!sockets[server_id].send(buffer.data(), buffer.size())) {
-				std::cout << "Something happened while sending the call to the server\n";
-				int error_code = WSAGetLastError();
-				std::cout << "Error code: " << error_code;
-				error = errors::connection_failure;
+			const schema_entry* entry = find_entry(endpoints[server_id], func_id, schema_kinds::function);
+			if (!matches<Args...>(entry))
 				return misc::buffer<>();
-			}
-			buffer.clear();
+			trace_span span(tracing, tracing.sample(), func_id);
+			const trace_scope traced(span);
+			if (const std::shared_ptr<const misc::buffer<>>* cached = find_memoized(func_id, args...))
+				return copy_of(**cached);
+			return call_remote(server_id, entry, func_id, span, args...);
+		}
+
+		// like call_function, but a memoized result is shared with the cache instead of copied;
+		// null if the call failed
+		template<typename ...Args>
+		std::shared_ptr<const misc::buffer<>> call_shared(handle_t server_id, const std::string_view func_name, const Args&... args)
+		{
+			return call_shared(server_id, std::hash<std::string_view>{}(func_name), args...);
+		}
+		template<typename ...Args>
+		std::shared_ptr<const misc::buffer<>> call_shared(handle_t server_id, const id_t func_id, const Args&... args)
+		{
+			const schema_entry* entry = find_entry(endpoints[server_id], func_id, schema_kinds::function);
+			if (!matches<Args...>(entry))
+				return nullptr;
+			trace_span span(tracing, tracing.sample(), func_id);
+			const trace_scope traced(span);
+			if (const std::shared_ptr<const misc::buffer<>>* cached = find_memoized(func_id, args...))
+				return *cached;
+			misc::buffer<> buffer = call_remote(server_id, entry, func_id, span, args...);
+			if (buffer.is_null())
+				return nullptr;
+			return std::make_shared<const misc::buffer<>>(std::move(buffer));
+		}
+
+		// typed callable for a function, e.g. client.bind<float(float, float)>(server_id, "add");
+		// it is checked against the server's schema once, here, instead of on every call
+		template<typename Signature>
+		stub<Signature> bind(handle_t server_id, std::string_view func_name)
+		{
+			return stub<Signature>(*this, server_id, std::hash<std::string_view>{}(func_name));
+		}
+		template<typename Signature>
+		stub<Signature> bind(handle_t server_id, id_t func_id)
+		{
+			return stub<Signature>(*this, server_id, func_id);
+		}
+
+		template<typename ...Args>
+		misc::buffer<> call_function_hedged(const std::vector<handle_t>& replicas, const std::string_view func_name, const Args&... args)
+		{
+			return call_function_hedged(replicas, std::hash<std::string_view>{}(func_name), args...);
+		}
+
+		// sends the call to the fastest replica and, if the function is idempotent and no reply
+		// came within the hedging delay, to the second fastest one; the first reply wins
+		template<typename ...Args>
+		misc::buffer<> call_function_hedged(const std::vector<handle_t>& replicas, const id_t func_id, const Args&... args)
+		{
+			assert(!replicas.empty());
+			const handle_t primary = fastest(replicas, null_handle);
+			if (replicas.size() < 2 || !idempotent_functions.contains(func_id))
+				return call_function(primary, func_id, args...);
+			// replicas may number their functions differently, the hedged packet goes by id
+			if (!matches<Args...>(find_entry(endpoints[primary], func_id, schema_kinds::function)))
+				return misc::buffer<>();
+			const handle_t secondary = fastest(replicas, primary);
+			if (!serves<Args...>(endpoints[secondary], func_id))
+				return call_function(primary, func_id, args...);
+
+			trace_span span(tracing, tracing.sample(), func_id);
+			const trace_scope traced(span);
+			if (const std::shared_ptr<const misc::buffer<>>* cached = find_memoized(func_id, args...))
+				return copy_of(**cached);
+			misc::buffer<> packet = form_packet(opcodes::call_function, func_id, args...);
+			span.mark(trace_stages::encode);
+
+			frame_flags_t reply_flags = frame_flags::none;
+			misc::buffer<> buffer = hedge(primary, secondary, packet, reply_flags);
+			if (buffer.is_null())
+				return buffer;
 
-			buffer = receive_and_return(server_id, buffer);
 			status_t status = get_call_status(buffer);
+			if (status == status_codes::overloaded) {
+				error = errors::overloaded;
+				return misc::buffer<>();
+			}
 			assert(status == status_codes::good);
+			remember(func_id, arguments_of(packet), reply_flags, buffer);
+			span.mark(trace_stages::decode);
 			return buffer;
 		}
 
+		stream_call open_stream(handle_t server_id, std::string_view func_name)
+		{
+			return open_stream(server_id, std::hash<std::string_view>{}(func_name));
+		}
+
+		// starts a call to a stream function; arguments are written to the input of the returned call,
+		// the result is read from its output after the input is closed
+		stream_call open_stream(handle_t server_id, id_t func_id)
+		{
+			endpoint& target = endpoints[server_id];
+			misc::buffer<> packet = form_packet(opcodes::call_stream, func_id);
+			const call_id_t call_id = send_call(target, packet);
+			if (call_id == null_call_id)
+				return stream_call{};
+
+			const std::size_t threshold = (target.features & features::compression)
+				? compression.threshold : std::numeric_limits<std::size_t>::max();
+			return stream_call{ stream_writer(target.link, call_id, threshold), stream_reader(target.link, call_id) };
+		}
+
+		template<typename T, typename ...Args>
+		sequence<T> call_sequence(handle_t server_id, std::string_view func_name, const Args&... args)
+		{
+			return call_sequence<T>(server_id, std::hash<std::string_view>{}(func_name), args...);
+		}
+
+		// calls a function returning rpc::generator<T>, items can be iterated while the rest is still being produced
+		template<typename T, typename ...Args>
+		sequence<T> call_sequence(handle_t server_id, id_t func_id, const Args&... args)
+		{
+			stream_call call = open_stream(server_id, func_id);
+			call.input.write_item(args...);
+			call.input.close();
+			return sequence<T>(std::move(call.output));
+		}
+
 		template<typename ...Args>
 		id_t create_object(handle_t server_id, std::string_view type_name, std::string_view object_name, const Args&... args)
 		{
@@ -85,15 +377,12 @@ namespace rpc
 		template<typename ...Args>
 		id_t create_object(handle_t server_id, id_t type_id, id_t object_id, const Args&... args)
 		{
+			if (!matches<Args...>(find_entry(endpoints[server_id], type_id, schema_kinds::type)))
+				return null_id;
 			misc::buffer<> buffer = form_packet(opcodes::create_object, type_id, object_id, args...);
-			
-			if (!sockets[server_id].send(buffer.data(), buffer.size())) {
-				std::cout << "Something happened while sending the call to the server\n";
-				int error_code = WSAGetLastError();
-				std::cout << "Error code: " << error_code;
-				error = errors::connection_failure;
+
+			if (send_call(endpoints[server_id], buffer) == null_call_id)
 				return null_id;
-			}
 			buffer.clear();
 			std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
@@ -126,54 +415,555 @@ namespace rpc
 		template<typename ...Args>
 		misc::buffer<> call_method(handle_t server_id, id_t method_id, id_t object_id, const Args&... args)
 		{
-			misc::buffer<> buffer = form_packet(opcodes::call_method, method_id, object_id, args...);
+			const schema_entry* entry = find_entry(endpoints[server_id], method_id, schema_kinds::method);
+			if (!matches<Args...>(entry))
+				return misc::buffer<>();
+			trace_span span(tracing, tracing.sample(), method_id);
+			const trace_scope traced(span);
+			misc::buffer<> packet = entry ? form_packet(opcodes::call_method_indexed, entry->index, object_id, args...)
+				: form_packet(opcodes::call_method, method_id, object_id, args...);
+			span.mark(trace_stages::encode);
+			frame_flags_t reply_flags = frame_flags::none;
+			misc::buffer<> buffer = transact(server_id, packet, reply_flags);
+			if (buffer.is_null())
+				return buffer;
 
-			if (!sockets[server_id].send(buffer.data(), buffer.size())) {
-				std::cout << "Something happened while sending the call to the server\n";
-				int error_code = WSAGetLastError();
-				std::cout << "Error code: " << error_code;
-				error = errors::connection_failure;
+			status_t status = get_call_status(buffer);
+			if (status == status_codes::overloaded) {
+				error = errors::overloaded;
 				return misc::buffer<>();
 			}
-			buffer.clear();
-			buffer = receive_and_return(server_id, buffer);
-			status_t status = get_call_status(buffer);
 			assert(status == status_codes::good);
+			span.mark(trace_stages::decode);
 			return buffer;
 		}
 
-		misc::buffer<> receive_and_return(handle_t server_id, misc::buffer<>& buffer)
+		misc::buffer<> receive_and_return(handle_t server_id, call_id_t call_id)
+		{
+			frame_flags_t reply_flags;
+			return receive_and_return(server_id, call_id, reply_flags);
+		}
+		misc::buffer<> receive_and_return(handle_t server_id, call_id_t call_id, frame_flags_t& reply_flags)
+		{
+			return receive_until(endpoints[server_id], call_id, reply_flags, clock::time_point::max());
+		}
+
+		status_t get_call_status(misc::buffer<>& buffer)
+		{
+			status_t status_code = misc::get<status_t>(buffer.data(), 0);
+			buffer.left_shift(sizeof(status_t));
+
+			return status_code;
+		}
+
+
+		error_t get_error() const { return error; }
+		void null_error() { error = errors::no_error; }
+
+	private:
+		// stamps the packet with a fresh call id, the time left until the deadline and the trace id, and sends it
+		call_id_t send_call(endpoint& target, misc::buffer<>& packet, clock::time_point deadline = clock::time_point::max())
 		{
-			auto return_value = sockets[server_id].receive(buffer.data_nc(), buffer.capacity());
-			if (return_value == 0) {
-				std::cout << "0 bytes received\n";
-				int error_code = WSAGetLastError();
+			const call_id_t call_id = next_call_id++ % null_call_id;
+			seal_frame(packet, call_id);
+			header_of(packet).timeout = timeout_until(deadline);
+			header_of(packet).trace_id = this_trace::id();
+
+			// packet itself stays uncompressed, it may be resent to another replica
+			misc::buffer<> compressed;
+			const misc::buffer<>& frame = ((target.features & features::compression)
+				&& compress_frame(packet, compression.threshold, compressed)) ? compressed : packet;
+			if (!target.link.send(frame.data(), frame.size())) {
+				std::cout << "Something happened while sending the call to the server\n";
+				int error_code = net::last_error();
 				std::cout << "Error code: " << error_code;
 				error = errors::connection_failure;
-				return misc::buffer<>();
+				return null_call_id;
 			}
-			else if (return_value < 0) {
+			this_trace::set_call_id(call_id);
+			this_trace::mark(trace_stages::send);
+			return call_id;
+		}
+
+		// receives a single frame
+		bool receive_one(endpoint& target, frame_header& header, misc::buffer<>& buffer)
+		{
+			if (!target.link.receive(header, buffer)) {
 				std::cout << "Some error happened while recieve data from server \n";
-				int error_code = WSAGetLastError();
+				int error_code = net::last_error();
 				std::cout << "Error code: " << error_code;
 				error = errors::connection_failure;
+				return false;
+			}
+			return true;
+		}
+
+		// waits for the reply to the call, once the deadline passes the call is cancelled;
+		// the deadline is the timeout of the wait rather than a timing_wheel timer, a call waits
+		// on its own socket only so there is no list of deadlines a wheel would save scanning
+		misc::buffer<> receive_until(endpoint& target, call_id_t call_id, frame_flags_t& reply_flags, clock::time_point deadline)
+		{
+			misc::buffer<> reply;
+			if (!receive_until(target, call_id, reply_flags, deadline, reply))
 				return misc::buffer<>();
+			return reply;
+		}
+		// receives into a buffer of the caller, which is reused for every frame read on the way
+		bool receive_until(endpoint& target, call_id_t call_id, frame_flags_t& reply_flags, clock::time_point deadline, misc::buffer<>& reply)
+		{
+			while (true) {
+				if (deadline != clock::time_point::max()) {
+					const int ready = target.link.wait(time_left(deadline));
+					if (ready == -1) {
+						abandon(target, call_id);
+						error = errors::timeout;
+						return false;
+					}
+					if (ready < 0) {
+						error = errors::connection_failure;
+						return false;
+					}
+					// a control frame alone wakes the wait too, receiving would then block past the deadline
+					if (!target.link.poll()) {
+						error = errors::connection_failure;
+						return false;
+					}
+					if (!target.link.has_pending())
+						continue;
+				}
+
+				frame_header header;
+				if (!receive_one(target, header, reply))
+					return false;
+				if (header.call_id == call_id) {
+					reply_flags = header.flags;
+					this_trace::mark(trace_stages::wait);
+					return true;
+				}
+				if (!discard(target, header))
+					return false;
+			}
+		}
+
+		// frames nobody waits for, such as late chunks of an abandoned stream,
+		// still give the credit charged for their data back
+		bool discard(endpoint& target, const frame_header& header)
+		{
+			if ((header.flags & frame_flags::stream_chunk) && !target.link.consume(header.size)) {
+				error = errors::connection_failure;
+				return false;
 			}
+			return true;
+		}
+
+		// the server stops working on the call and doesn't reply; a reply already on its way
+		// is skipped like any frame of a call nobody waits for
+		void abandon(endpoint& target, call_id_t call_id)
+		{
+			target.link.send_cancel(call_id);
+		}
+
+		// true once a frame other than a control frame arrived before until, which ends the wait early
+		static bool receive_arrived(endpoint& target, clock::time_point until)
+		{
+			while (!target.link.has_pending()) {
+				if (clock::now() >= until || target.link.wait(time_left(until)) != 0 || !target.link.poll())
+					return false;
+			}
+			return true;
+		}
+
+		clock::time_point deadline_from(clock::time_point start) const
+		{
+			return (timeout.count() > 0) ? start + timeout : clock::time_point::max();
+		}
+
+		int wait_either(const socket_t (&handles)[2], clock::time_point deadline) const
+		{
+			if (busy_poll.enabled) {
+				const std::chrono::microseconds left = time_left(deadline);
+				const int ready = spin_readable(handles, 2, (left.count() < 0) ? busy_poll.spin : std::min(busy_poll.spin, left));
+				if (ready != -1)
+					return ready;
+			}
+			return net::wait_readable(handles, 2, time_left(deadline));
+		}
+
+		// negative without a deadline, which makes waiting for sockets wait forever
+		static std::chrono::microseconds time_left(clock::time_point deadline)
+		{
+			if (deadline == clock::time_point::max())
+				return std::chrono::microseconds(-1);
+			const auto now = clock::now();
+			return (now < deadline) ? std::chrono::duration_cast<std::chrono::microseconds>(deadline - now) : std::chrono::microseconds(0);
+		}
+
+		misc::buffer<> transact(handle_t server_id, misc::buffer<>& packet, frame_flags_t& reply_flags)
+		{
+			misc::buffer<> reply;
+			if (!transact(server_id, packet, reply_flags, reply))
+				return misc::buffer<>();
+			return reply;
+		}
+		bool transact(handle_t server_id, misc::buffer<>& packet, frame_flags_t& reply_flags, misc::buffer<>& reply)
+		{
+			endpoint& target = endpoints[server_id];
+			const auto start = clock::now();
+			const clock::time_point deadline = deadline_from(start);
+			const call_id_t call_id = send_call(target, packet, deadline);
+			if (call_id == null_call_id)
+				return false;
+
+			if (!receive_until(target, call_id, reply_flags, deadline, reply))
+				return false;
+			// quick rejections say nothing about how fast the server executes calls
+			if (!is_overloaded(reply))
+				record_latency(target, clock::now() - start);
+			return true;
+		}
+
+		misc::buffer<> hedge(handle_t primary_id, handle_t secondary_id, misc::buffer<>& packet, frame_flags_t& reply_flags)
+		{
+			endpoint& primary = endpoints[primary_id];
+			endpoint& secondary = endpoints[secondary_id];
+
+			const auto start = clock::now();
+			const clock::time_point deadline = deadline_from(start);
+			const call_id_t primary_call = send_call(primary, packet, deadline);
+			if (primary_call == null_call_id)
+				return transact(secondary_id, packet, reply_flags);
+
+			// the hedge is not worth sending if the deadline comes first
+			const std::chrono::microseconds delay = hedge_delay(primary);
+			if (deadline - start <= delay || receive_arrived(primary, start + delay)) {
+				misc::buffer<> reply = receive_until(primary, primary_call, reply_flags, deadline);
+				// overloaded primary hands the call over to the secondary right away
+				if (is_overloaded(reply))
+					return transact(secondary_id, packet, reply_flags);
+				if (!reply.is_null())
+					record_latency(primary, clock::now() - start);
+				return reply;
+			}
+
+			// primary is late, the same packet goes to the secondary replica and the first reply wins
+			const auto hedge_start = clock::now();
+			const call_id_t secondary_call = send_call(secondary, packet, deadline);
+			if (secondary_call == null_call_id)
+				return receive_until(primary, primary_call, reply_flags, deadline);
+
+			// both calls must be on the wire before waiting on the sockets directly
+			if (!primary.link.flush() || !secondary.link.flush()) {
+				error = errors::connection_failure;
+				return misc::buffer<>();
+			}
+			const socket_t handles[] = { primary.link.socket().native_handle(), secondary.link.socket().native_handle() };
+			bool overloaded[] = { false, false };
+			while (true) {
+				// frames queued while waiting for credit are ready without touching the sockets
+				const int ready = primary.link.has_pending() ? 0 : secondary.link.has_pending() ? 1
+					: wait_either(handles, deadline);
+				if (ready == -1) {
+					if (!overloaded[0])
+						abandon(primary, primary_call);
+					if (!overloaded[1])
+						abandon(secondary, secondary_call);
+					error = errors::timeout;
+					return misc::buffer<>();
+				}
+				if (ready < 0) {
+					error = errors::connection_failure;
+					return misc::buffer<>();
+				}
+
+				endpoint& winner = (ready == 0) ? primary : secondary;
+				const call_id_t winner_call = (ready == 0) ? primary_call : secondary_call;
+				// the readable bytes may be control frames only, receiving would then block on this replica
+				// while the other one answers or the deadline passes
+				if (!winner.link.poll()) {
+					error = errors::connection_failure;
+					return misc::buffer<>();
+				}
+				if (!winner.link.has_pending())
+					continue;
+				frame_header header;
+				misc::buffer<> reply;
+				if (!receive_one(winner, header, reply))
+					return misc::buffer<>();
+				if (header.call_id != winner_call) {
+					if (!discard(winner, header))
+						return misc::buffer<>();
+					continue;
+				}
+				// an overloaded replica leaves the call to the other one, unless that one is overloaded too
+				if (is_overloaded(reply)) {
+					if (overloaded[1 - ready])
+						return reply;
+					overloaded[ready] = true;
+					continue;
+				}
+
+				reply_flags = header.flags;
+				const auto now = clock::now();
+				if (ready == 0) {
+					record_latency(primary, now - start);
+					if (!overloaded[1])
+						abandon(secondary, secondary_call);
+				}
+				else {
+					record_latency(secondary, now - hedge_start);
+					// primary took at least that long, remembering it keeps its percentiles honest
+					record_latency(primary, now - start);
+					if (!overloaded[0])
+						abandon(primary, primary_call);
+				}
+				return reply;
+			}
+		}
+
+		static bool is_overloaded(const misc::buffer<>& reply)
+		{
+			return !reply.is_empty() && misc::get<status_t>(reply.data(), 0) == status_codes::overloaded;
+		}
+
+		static const schema_entry* find_entry(const endpoint& target, id_t id, schema_kind_t kind)
+		{
+			auto it = target.schema.find(id);
+			return (it != target.schema.end() && it->second.kind == kind) ? &it->second : nullptr;
+		}
+
+		// a replica that sent its schema gets a hedge only if it lists the function with these arguments,
+		// one without a schema is sent it unchecked
+		template<typename ...Args>
+		static bool serves(const endpoint& target, id_t func_id)
+		{
+			if (target.schema.empty())
+				return true;
+			const schema_entry* entry = find_entry(target, func_id, schema_kinds::function);
+			return entry && entry->arguments == arguments_signature<Args...>();
+		}
+
+		// arguments of calls the server didn't list are sent unchecked
+		template<typename ...Args>
+		bool matches(const schema_entry* entry)
+		{
+			if (!entry || entry->arguments == arguments_signature<Args...>())
+				return true;
+			error = errors::signature_mismatch;
+			return false;
+		}
 
-			buffer.set_size(return_value);
+		// arguments of a call_function packet follow the header, opcode and function id or index
+		static std::string_view arguments_of(const misc::buffer<>& packet)
+		{
+			const bool indexed = packet.data()[sizeof(frame_header)] == opcodes::call_function_indexed;
+			const std::size_t offset = sizeof(frame_header) + sizeof(opcode_t) + (indexed ? sizeof(index_t) : sizeof(id_t));
+			return std::string_view(reinterpret_cast<const char*>(packet.data()) + offset, packet.size() - offset);
+		}
+
+		// serializes only the arguments, into memo_key, so a hit builds no packet
+		template<typename ...Args>
+		const std::shared_ptr<const misc::buffer<>>* find_memoized(id_t func_id, const Args&... args)
+		{
+			if (!cacheable_functions.contains(func_id))
+				return nullptr;
+			memo_key.clear();
+			if (!memo_key.reserve(misc::encoded_size(args...)))
+				return nullptr;
+			memo_key.add(args...);
+			return find_cached(func_id, std::string_view(reinterpret_cast<const char*>(memo_key.data()), memo_key.size()));
+		}
+
+		const std::shared_ptr<const misc::buffer<>>* find_cached(id_t func_id, std::string_view arguments)
+		{
+			if (!cacheable_functions.contains(func_id))
+				return nullptr;
+			return results.find(call_key_view{ func_id, arguments });
+		}
+
+		void remember(id_t func_id, std::string_view arguments, frame_flags_t reply_flags, const misc::buffer<>& result)
+		{
+			if (reply_flags & frame_flags::cacheable)
+				cacheable_functions.insert(func_id);
+			if (!cacheable_functions.contains(func_id))
+				return;
+
+			results.put(call_key{ func_id, std::string(arguments) }, std::make_shared<const misc::buffer<>>(copy_of(result)),
+				arguments.size() + result.size());
+		}
+
+		// the part of call_function past the cache lookup
+		template<typename ...Args>
+		misc::buffer<> call_remote(handle_t server_id, const schema_entry* entry, id_t func_id, trace_span& span, const Args&... args)
+		{
+			misc::buffer<> packet = entry ? form_packet(opcodes::call_function_indexed, entry->index, args...)
+				: form_packet(opcodes::call_function, func_id, args...);
+			span.mark(trace_stages::encode);
+
+			frame_flags_t reply_flags = frame_flags::none;
+			misc::buffer<> buffer = transact(server_id, packet, reply_flags);
+			if (buffer.is_null())
+				return buffer;
+
+			status_t status = get_call_status(buffer);
+			if (status == status_codes::overloaded) {
+				error = errors::overloaded;
+				return misc::buffer<>();
+			}
+			assert(status == status_codes::good);
+			remember(func_id, arguments_of(packet), reply_flags, buffer);
+			span.mark(trace_stages::decode);
 			return buffer;
 		}
 
-		status_t get_call_status(misc::buffer<>& buffer)
+		static misc::buffer<> copy_of(const misc::buffer<>& buffer)
 		{
-			status_t status_code = misc::get<status_t>(buffer.data(), 0);
-			buffer.left_shift(sizeof status_t);
+			misc::buffer<> copy(buffer.size());
+			if (!buffer.is_empty())
+				copy.add(buffer);
+			return copy;
+		}
 
-			return status_code;
+		std::chrono::microseconds hedge_delay(const endpoint& target) const
+		{
+			if (target.latency.count() < hedging.min_samples)
+				return hedging.initial_delay;
+			const std::chrono::microseconds delay = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::nanoseconds(target.latency.percentile(hedging.percentile)));
+			return (delay > hedging.min_delay) ? delay : hedging.min_delay;
 		}
 
+		// replica with the lowest median latency, endpoints without samples are tried first
+		handle_t fastest(const std::vector<handle_t>& replicas, handle_t except)
+		{
+			handle_t best = null_handle;
+			std::uint64_t best_latency = std::numeric_limits<std::uint64_t>::max();
+			for (handle_t replica : replicas) {
+				if (replica == except)
+					continue;
+				const std::uint64_t median = endpoints[replica].latency.percentile(0.5);
+				if (best == null_handle || median < best_latency) {
+					best = replica;
+					best_latency = median;
+				}
+			}
+			return best;
+		}
 
-		error_t get_error() const { return error; }
-		error_t null_error() { error = errors::no_error; }
+		void record_latency(endpoint& target, clock::duration duration)
+		{
+			target.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
+			if (target.latency.count() >= hedging.window)
+				target.latency.decay();
+		}
+	};
+
+	// calls one function of one server with the types of Signature: the id, opcode and index are
+	// written once into a packet prefix, arguments are encoded into a buffer kept between calls, replies
+	// are received into another one and the result is decoded straight from it, into a new value or
+	// into storage of the caller with into(). A failed call returns Ret{} and sets the client's error
+	template<typename Ret, typename ...Args>
+	class stub<Ret(Args...)>
+	{
+	private:
+		using result_type = std::decay_t<Ret>;
+
+		client* m_client = nullptr;
+		handle_t m_server = null_handle;
+		id_t m_id = null_id;
+		// header, opcode and id or index of every packet
+		misc::buffer<> m_prefix;
+		misc::buffer<> m_packet;
+		misc::buffer<> m_reply;
+		bool m_valid = false;
+
+	public:
+		stub() {}
+		stub(client& owner, handle_t server_id, id_t func_id)
+			: m_client(&owner), m_server(server_id), m_id(func_id)
+		{
+			const schema_entry* entry = client::find_entry(owner.endpoints[server_id], func_id, schema_kinds::function);
+			if (entry && (entry->arguments != arguments_signature<std::decay_t<Args>...>() || entry->result != type_signature<result_type>())) {
+				owner.error = errors::signature_mismatch;
+				return;
+			}
+			m_prefix = entry ? form_packet(opcodes::call_function_indexed, entry->index) : form_packet(opcodes::call_function, func_id);
+			m_valid = true;
+		}
+
+		// false if the server registered the function with another signature
+		bool is_valid() const { return m_valid; }
+		id_t id() const { return m_id; }
+
+		result_type operator()(const Args&... args)
+		{
+			const std::optional<std::span<const std::uint8_t>> result = call(args...);
+			if constexpr (std::is_void_v<result_type>)
+				return;
+			else if (!result)
+				return result_type();
+			else
+				return misc::decode<result_type>(result->data(), result->size());
+		}
+
+		// decodes the result into out: a container keeps its storage and allocates only when its capacity
+		// is too small, so fetching large arrays repeatedly doesn't churn the heap. False if the call failed
+		template<typename T = result_type>
+		bool into(T& out, const Args&... args) requires (!std::is_void_v<T> && std::is_same_v<T, result_type>)
+		{
+			const std::optional<std::span<const std::uint8_t>> result = call(args...);
+			if (!result)
+				return false;
+			misc::decode_into(result->data(), result->size(), out);
+			return true;
+		}
+		// copies the elements of a container result into out and returns how many the result holds,
+		// only the first out.size() are copied if it holds more; 0 with the client's error set if the call failed
+		template<typename T>
+		std::size_t into(std::span<T> out, const Args&... args) requires misc::is_container<result_type>::value
+		{
+			const std::optional<std::span<const std::uint8_t>> result = call(args...);
+			if (!result)
+				return 0;
+			return misc::decode_into(result->data(), result->size(), out);
+		}
+
+	private:
+		// bytes of the result, without the status, in the cache or in m_reply until the next call
+		std::optional<std::span<const std::uint8_t>> call(const Args&... args)
+		{
+			if (!m_valid) {
+				m_client->error = errors::signature_mismatch;
+				return std::nullopt;
+			}
+			trace_span span(m_client->tracing, m_client->tracing.sample(), m_id);
+			const trace_scope traced(span);
+			m_packet.clear();
+			if (!m_packet.reserve(m_prefix.size() + misc::encoded_size(args...))) {
+				m_client->error = errors::bad_request;
+				return std::nullopt;
+			}
+			m_packet.add(m_prefix);
+			m_packet.add(args...);
+			span.mark(trace_stages::encode);
+
+			if (const std::shared_ptr<const misc::buffer<>>* cached = m_client->find_cached(m_id, client::arguments_of(m_packet)))
+				return std::span<const std::uint8_t>((*cached)->data(), (*cached)->size());
+			frame_flags_t reply_flags = frame_flags::none;
+			if (!m_client->transact(m_server, m_packet, reply_flags, m_reply) || m_reply.is_empty())
+				return std::nullopt;
+			const status_t status = m_reply.data()[0];
+			if (status != status_codes::good) {
+				m_client->error = (status == status_codes::overloaded) ? errors::overloaded : errors::bad_request;
+				return std::nullopt;
+			}
+			// the cache keeps results without their status, like call_function returns them
+			if ((reply_flags & frame_flags::cacheable) || m_client->cacheable_functions.contains(m_id)) {
+				misc::buffer<> result(m_reply.size() - sizeof(status_t));
+				result.add(m_reply.data() + sizeof(status_t), m_reply.size() - sizeof(status_t));
+				m_client->remember(m_id, client::arguments_of(m_packet), reply_flags, result);
+			}
+			span.mark(trace_stages::decode);
+			return std::span<const std::uint8_t>(m_reply.data() + sizeof(status_t), m_reply.size() - sizeof(status_t));
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace rpc
+{
+	// small LZ77 codec in the spirit of LZ4 block format:
+	// every sequence is a token (4 bits of literal length, 4 bits of match length - min_match),
+	// optional length extensions, the literals and a 2 byte offset of the match;
+	// the last sequence has literals only
+	namespace lz
+	{
+		constexpr std::size_t min_match = 4;
+		constexpr std::size_t max_offset = 65535;
+		constexpr std::size_t hash_bits = 12;
+
+		constexpr std::size_t max_compressed_size(std::size_t size)
+		{
+			return size + size / 255 + 16;
+		}
+
+		namespace detail
+		{
+			inline std::uint32_t read32(const std::uint8_t* data)
+			{
+				std::uint32_t value;
+				std::memcpy(&value, data, sizeof(value));
+				return value;
+			}
+
+			inline std::size_t hash(std::uint32_t sequence)
+			{
+				return (sequence * 2654435761u) >> (32 - hash_bits);
+			}
+
+			// writes the part of length that did not fit into the token
+			inline std::uint8_t* write_length(std::uint8_t* out, std::size_t length)
+			{
+				for (; length >= 255; length -= 255)
+					*out++ = 255;
+				*out++ = static_cast<std::uint8_t>(length);
+				return out;
+			}
+
+			inline bool read_length(const std::uint8_t*& in, const std::uint8_t* end, std::size_t& length)
+			{
+				std::uint8_t byte;
+				do {
+					if (in == end)
+						return false;
+					byte = *in++;
+					length += byte;
+				} while (byte == 255);
+				return true;
+			}
+
+			inline std::uint8_t* write_sequence(std::uint8_t* out, const std::uint8_t* literals, std::size_t literals_size,
+				std::size_t offset, std::size_t match_size)
+			{
+				std::uint8_t* token = out++;
+				*token = static_cast<std::uint8_t>(((literals_size < 15) ? literals_size : 15) << 4);
+				if (literals_size >= 15)
+					out = write_length(out, literals_size - 15);
+				if (literals_size > 0)
+					std::memcpy(out, literals, literals_size);
+				out += literals_size;
+
+				if (match_size == 0)
+					return out;
+				*out++ = static_cast<std::uint8_t>(offset);
+				*out++ = static_cast<std::uint8_t>(offset >> 8);
+				const std::size_t code = match_size - min_match;
+				*token |= static_cast<std::uint8_t>((code < 15) ? code : 15);
+				if (code >= 15)
+					out = write_length(out, code - 15);
+				return out;
+			}
+		}
+
+		// returns size of the compressed data or 0 if it would not fit into capacity
+		inline std::size_t compress(const std::uint8_t* source, std::size_t size, std::uint8_t* destination, std::size_t capacity)
+		{
+			if (capacity < max_compressed_size(size))
+				return 0;
+
+			// positions are stored + 1, so zero means an empty slot
+			std::array<std::uint32_t, std::size_t(1) << hash_bits> table = {};
+			std::uint8_t* out = destination;
+			std::size_t anchor = 0;
+			std::size_t position = 0;
+
+			while (position + min_match <= size) {
+				const std::uint32_t sequence = detail::read32(source + position);
+				std::uint32_t& slot = table[detail::hash(sequence)];
+				const std::size_t candidate = slot;
+				slot = static_cast<std::uint32_t>(position + 1);
+
+				if (candidate == 0 || position - (candidate - 1) > max_offset
+					|| detail::read32(source + candidate - 1) != sequence) {
+					++position;
+					continue;
+				}
+
+				const std::size_t reference = candidate - 1;
+				std::size_t match_size = min_match;
+				while (position + match_size < size && source[reference + match_size] == source[position + match_size])
+					++match_size;
+
+				out = detail::write_sequence(out, source + anchor, position - anchor, position - reference, match_size);
+				position += match_size;
+				anchor = position;
+			}
+
+			out = detail::write_sequence(out, source + anchor, size - anchor, 0, 0);
+			return static_cast<std::size_t>(out - destination);
+		}
+
+		// original_size must be known up front, returns false on malformed input
+		inline bool decompress(const std::uint8_t* source, std::size_t size, std::uint8_t* destination, std::size_t original_size)
+		{
+			const std::uint8_t* in = source;
+			const std::uint8_t* const in_end = source + size;
+			std::uint8_t* out = destination;
+			std::uint8_t* const out_end = destination + original_size;
+
+			while (in < in_end) {
+				const std::uint8_t token = *in++;
+
+				std::size_t literals_size = token >> 4;
+				if (literals_size == 15 && !detail::read_length(in, in_end, literals_size))
+					return false;
+				if (literals_size > static_cast<std::size_t>(in_end - in) || literals_size > static_cast<std::size_t>(out_end - out))
+					return false;
+				if (literals_size > 0)
+					std::memcpy(out, in, literals_size);
+				in += literals_size;
+				out += literals_size;
+
+				if (in == in_end)
+					break;
+				if (in_end - in < 2)
+					return false;
+				const std::size_t offset = in[0] | (std::size_t(in[1]) << 8);
+				in += 2;
+				if (offset == 0 || offset > static_cast<std::size_t>(out - destination))
+					return false;
+
+				std::size_t match_size = token & 15;
+				if (match_size == 15 && !detail::read_length(in, in_end, match_size))
+					return false;
+				match_size += min_match;
+				if (match_size > static_cast<std::size_t>(out_end - out))
+					return false;
+
+				// source and destination of the match may overlap
+				const std::uint8_t* match = out - offset;
+				if (offset >= match_size) {
+					std::memcpy(out, match, match_size);
+					out += match_size;
+				}
+				else {
+					for (std::size_t i = 0; i < match_size; ++i)
+						*out++ = match[i];
+				}
+			}
+			return out == out_end;
+		}
+	}
+}
\ No newline at end of file
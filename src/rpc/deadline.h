@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "frame.h"
+#include "channel.h"
+
+namespace rpc
+{
+
+	using deadline_clock = std::chrono::steady_clock;
+
+	// deadline of a call that arrived with the given header, counted from the arrival of its frame
+	inline deadline_clock::time_point deadline_of(const frame_header& header, deadline_clock::time_point arrival)
+	{
+		if (header.timeout == 0)
+			return deadline_clock::time_point::max();
+		return arrival + std::chrono::microseconds(header.timeout);
+	}
+
+	// budget to send along with a call, 0 if it has no deadline; never 0 for a deadline
+	// that already passed, so the server still drops the call
+	inline std::uint32_t timeout_until(deadline_clock::time_point deadline)
+	{
+		if (deadline == deadline_clock::time_point::max())
+			return 0;
+		const auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - deadline_clock::now()).count();
+		if (left <= 0)
+			return 1;
+		return (left < std::numeric_limits<std::uint32_t>::max()) ? static_cast<std::uint32_t>(left) : std::numeric_limits<std::uint32_t>::max();
+	}
+
+	// handed to the code executing a call, is_cancelled turns true once the deadline passed
+	// or the caller sent a cancel frame; handlers doing long work should poll it
+	class cancellation_token
+	{
+	private:
+		channel* m_channel = nullptr;
+		deadline_clock::time_point m_deadline = deadline_clock::time_point::max();
+
+	public:
+		cancellation_token() {}
+		cancellation_token(channel& link, deadline_clock::time_point deadline)
+			: m_channel(&link), m_deadline(deadline) {}
+
+		// reads frames that already arrived, so it is cheap but not free
+		bool is_cancelled() const
+		{
+			if (deadline_clock::now() >= m_deadline)
+				return true;
+			if (!m_channel)
+				return false;
+			m_channel->poll();
+			return m_channel->is_cancelled();
+		}
+
+		deadline_clock::time_point deadline() const { return m_deadline; }
+	};
+
+	// token of the call executed by the current thread, for handlers registered as plain functions
+	namespace this_call
+	{
+		namespace detail
+		{
+			inline thread_local const cancellation_token* current = nullptr;
+		}
+
+		inline bool is_cancelled() { return detail::current && detail::current->is_cancelled(); }
+
+		inline deadline_clock::time_point deadline()
+		{
+			return detail::current ? detail::current->deadline() : deadline_clock::time_point::max();
+		}
+	}
+
+	// makes the token visible through this_call while the call is executed
+	class call_scope
+	{
+	private:
+		const cancellation_token* m_previous;
+
+	public:
+		explicit call_scope(const cancellation_token& token) : m_previous(this_call::detail::current)
+		{
+			this_call::detail::current = &token;
+		}
+		~call_scope() { this_call::detail::current = m_previous; }
+
+		call_scope(const call_scope&) = delete;
+		call_scope& operator=(const call_scope&) = delete;
+	};
+
+}
\ No newline at end of file
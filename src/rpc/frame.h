@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#include "../networking/networking.h"
+#include "../networking/miscellaneous.h"
+#include "compression.h"
+
+namespace rpc
+{
+
+	using call_id_t = std::uint32_t;
+	using frame_flags_t = std::uint16_t;
+
+	const call_id_t null_call_id = std::numeric_limits<call_id_t>::max();
+
+	namespace frame_flags
+	{
+		const frame_flags_t none = 0;
+		// reply of a pure function, client may memoize it
+		const frame_flags_t cacheable = 1 << 0;
+		// payload is the original size (4 bytes) followed by lz compressed bytes
+		const frame_flags_t compressed = 1 << 1;
+		// part of a streamed argument or result, more frames of the same call follow
+		const frame_flags_t stream_chunk = 1 << 2;
+		// closes one direction of a streamed call, the result stream ends with the status
+		const frame_flags_t stream_end = 1 << 3;
+		// grants the peer more credit for stream data, payload is the increment (4 bytes);
+		// call id selects the stream or the whole connection
+		const frame_flags_t window_update = 1 << 4;
+		// caller gave up on the call with this id, no payload
+		const frame_flags_t cancel = 1 << 5;
+		// peer checks the connection is alive and is answered with pong, neither has a payload
+		const frame_flags_t ping = 1 << 6;
+		const frame_flags_t pong = 1 << 7;
+	}
+
+	// upper bound for a single frame, anything bigger is treated as a broken stream
+	const std::uint32_t max_frame_size = 64 * net::megabyte;
+
+#pragma pack(push, 1)
+	// every packet on the wire starts with this header,
+	// size is the number of payload bytes following it
+	struct frame_header
+	{
+		std::uint32_t size = 0;
+		// echoed back by the server so replies can be matched to calls
+		call_id_t call_id = 0;
+		frame_flags_t flags = frame_flags::none;
+		// microseconds the caller is still willing to wait for the reply, 0 means no deadline;
+		// relative so that clocks of both sides need not agree
+		std::uint32_t timeout = 0;
+		// id of the trace a sampled call belongs to, 0 if it isn't traced
+		std::uint64_t trace_id = 0;
+	};
+#pragma pack(pop)
+
+	// creates a buffer with space for the header and payload_size bytes after it,
+	// seal_frame must be called once the payload is written
+	inline misc::buffer<> make_frame(std::size_t payload_size)
+	{
+		misc::buffer<> frame(sizeof(frame_header) + payload_size);
+		frame.add(frame_header{});
+		return frame;
+	}
+
+	inline frame_header& header_of(misc::buffer<>& frame)
+	{
+		assert(frame.size() >= sizeof(frame_header));
+		return *reinterpret_cast<frame_header*>(frame.data_nc());
+	}
+
+	inline void seal_frame(misc::buffer<>& frame, call_id_t call_id, frame_flags_t flags = frame_flags::none)
+	{
+		frame_header& header = header_of(frame);
+		header.size = static_cast<std::uint32_t>(frame.size() - sizeof(frame_header));
+		header.call_id = call_id;
+		header.flags = flags;
+	}
+
+	// writes a compressed copy of a sealed frame into compressed if its payload is at least
+	// threshold bytes long and compression actually shrinks it, the frame itself is kept intact
+	inline bool compress_frame(const misc::buffer<>& frame, std::size_t threshold, misc::buffer<>& compressed)
+	{
+		const std::size_t size = frame.size() - sizeof(frame_header);
+		if (size < threshold || size > max_frame_size)
+			return false;
+
+		frame_header header = *reinterpret_cast<const frame_header*>(frame.data());
+		compressed = misc::buffer<>(sizeof(frame_header) + sizeof(std::uint32_t) + lz::max_compressed_size(size));
+		compressed.add(header, static_cast<std::uint32_t>(size));
+
+		const std::size_t packed = lz::compress(frame.data() + sizeof(frame_header), size,
+			compressed.data_nc() + compressed.size(), compressed.capacity() - compressed.size());
+		if (packed == 0 || packed + sizeof(std::uint32_t) >= size)
+			return false;
+		compressed.set_size(compressed.size() + packed);
+
+		header.size = static_cast<std::uint32_t>(compressed.size() - sizeof(frame_header));
+		header.flags |= frame_flags::compressed;
+		header_of(compressed) = header;
+		return true;
+	}
+
+	// replaces a compressed payload with the original bytes and drops the flag from the header
+	inline bool decompress_payload(frame_header& header, misc::buffer<>& payload)
+	{
+		if (payload.size() < sizeof(std::uint32_t))
+			return false;
+		const std::uint32_t size = misc::get<std::uint32_t>(payload.data(), 0);
+		if (size > max_frame_size)
+			return false;
+
+		misc::buffer<> original(size);
+		if (original.is_null() || !lz::decompress(payload.data() + sizeof(std::uint32_t), payload.size() - sizeof(std::uint32_t), original.data_nc(), size))
+			return false;
+		original.set_size(size);
+
+		payload = std::move(original);
+		header.size = size;
+		header.flags &= ~frame_flags::compressed;
+		return true;
+	}
+
+	// reads one whole frame, payload is stored without the header and already decompressed
+	template<typename Socket>
+	bool receive_frame(const Socket& socket, frame_header& header, misc::buffer<>& payload)
+	{
+		if (!socket.receive_all(&header, sizeof(frame_header)))
+			return false;
+		if (header.size > max_frame_size)
+			return false;
+
+		payload.clear();
+		if (!payload.reserve(header.size))
+			return false;
+		if (header.size > 0 && !socket.receive_all(payload.data_nc(), header.size))
+			return false;
+		payload.set_size(header.size);
+
+		if (header.flags & frame_flags::compressed)
+			return decompress_payload(header, payload);
+		return true;
+	}
+
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace rpc
+{
+
+	// minimal synchronous generator standing in for std::generator (C++23);
+	// functions returning it have their items sent to the client one frame each
+	template<typename T>
+	class generator
+	{
+	public:
+		struct promise_type
+		{
+			// yielded value lives in the coroutine frame until it is resumed
+			const T* value = nullptr;
+
+			generator get_return_object() { return generator(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			std::suspend_always yield_value(const T& yielded) noexcept
+			{
+				value = std::addressof(yielded);
+				return {};
+			}
+			void return_void() noexcept {}
+			void unhandled_exception() { throw; }
+		};
+
+		class iterator
+		{
+		private:
+			std::coroutine_handle<promise_type> m_handle;
+
+		public:
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+
+			iterator() = default;
+			explicit iterator(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+			const T& operator*() const { return *m_handle.promise().value; }
+			iterator& operator++()
+			{
+				m_handle.resume();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			bool operator==(std::default_sentinel_t) const { return !m_handle || m_handle.done(); }
+		};
+
+	private:
+		std::coroutine_handle<promise_type> m_handle;
+
+		explicit generator(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+	public:
+		generator(generator&& other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+		generator& operator=(generator&& other) noexcept
+		{
+			if (m_handle)
+				m_handle.destroy();
+			m_handle = std::exchange(other.m_handle, {});
+			return *this;
+		}
+		generator(const generator&) = delete;
+		generator& operator=(const generator&) = delete;
+		~generator()
+		{
+			if (m_handle)
+				m_handle.destroy();
+		}
+
+		iterator begin()
+		{
+			if (m_handle)
+				m_handle.resume();
+			return iterator(m_handle);
+		}
+		std::default_sentinel_t end() const { return {}; }
+	};
+
+	template<typename T>
+	struct is_generator : std::false_type {};
+	template<typename T>
+	struct is_generator<generator<T>> : std::true_type {};
+
+}
\ No newline at end of file
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "miscellaneous.h"
+#include "statistics.h"
+#include "mpsc_queue.h"
+#include "trace.h"
+
+namespace rpc
+{
+
+	// totals of one function, method or type over all calls of it
+	struct call_metrics
+	{
+		std::uint64_t calls = 0;
+		// answered with a status other than good, cancelled or broken off
+		std::uint64_t errors = 0;
+		// answered as overloaded or dropped after the caller's deadline, not executed
+		std::uint64_t rejected = 0;
+		std::uint64_t bytes_in = 0;
+		std::uint64_t bytes_out = 0;
+		// from arrival of the call until it started executing
+		latency_histogram queueing;
+		// until the reply was handed to the channel
+		latency_histogram execution;
+		// allocated and copied in every stage of the executed calls, counted with RPC_ACCOUNTING only
+		stage_accounting::stages_t stages = {};
+
+		void merge(const call_metrics& other)
+		{
+			calls += other.calls;
+			errors += other.errors;
+			rejected += other.rejected;
+			bytes_in += other.bytes_in;
+			bytes_out += other.bytes_out;
+			queueing.merge(other.queueing);
+			execution.merge(other.execution);
+			for (std::size_t i = 0; i < trace_stages::count; ++i)
+				stages[i] += other.stages[i];
+		}
+
+		// over all stages
+		misc::accounting::counters accounted() const
+		{
+			misc::accounting::counters total;
+			for (const misc::accounting::counters& stage : stages)
+				total += stage;
+			return total;
+		}
+	};
+
+	using metrics_snapshot = std::map<id_t, call_metrics>;
+
+	// metrics recorded by one thread and read by any: counters are relaxed atomics written with
+	// a plain load and store instead of a locked read-modify-write, so a call costs a few nanoseconds
+	// to record and the lines of a shard move to another core only while a snapshot is taken
+	class metrics_shard
+	{
+	private:
+		using counter = std::atomic<std::uint64_t>;
+
+		struct stage_counters
+		{
+			counter allocations;
+			counter allocated_bytes;
+			counter copied_bytes;
+		};
+
+		struct alignas(cache_line_size) entry
+		{
+			counter calls;
+			counter errors;
+			counter rejected;
+			counter bytes_in;
+			counter bytes_out;
+			std::array<counter, latency_histogram::buckets> queueing;
+			std::array<counter, latency_histogram::buckets> execution;
+			std::array<stage_counters, trace_stages::count> stages;
+		};
+
+		// guards the structure of the map, the owner takes it only to add an id
+		std::mutex m_mutex;
+		std::unordered_map<id_t, std::unique_ptr<entry>> m_entries;
+		// consecutive calls mostly go to the same function
+		id_t m_last_id = null_id;
+		entry* m_last = nullptr;
+
+	public:
+		metrics_shard() {}
+		metrics_shard(const metrics_shard&) = delete;
+		metrics_shard& operator=(const metrics_shard&) = delete;
+
+		// called by the owner only, accounting may be null
+		void record_call(id_t id, std::uint64_t bytes_in, std::uint64_t bytes_out, bool failed,
+			std::chrono::nanoseconds queueing, std::chrono::nanoseconds execution, const stage_accounting* accounting = nullptr)
+		{
+			entry& target = at(id);
+			add(target.calls, 1);
+			if (failed)
+				add(target.errors, 1);
+			add(target.bytes_in, bytes_in);
+			add(target.bytes_out, bytes_out);
+			add(target.queueing[latency_histogram::index_of(nanoseconds_of(queueing))], 1);
+			add(target.execution[latency_histogram::index_of(nanoseconds_of(execution))], 1);
+			if constexpr (misc::accounting::enabled) {
+				if (!accounting)
+					return;
+				for (std::size_t i = 0; i < trace_stages::count; ++i) {
+					const misc::accounting::counters& counted = accounting->stages()[i];
+					add(target.stages[i].allocations, counted.allocations);
+					add(target.stages[i].allocated_bytes, counted.allocated_bytes);
+					add(target.stages[i].copied_bytes, counted.copied_bytes);
+				}
+			}
+		}
+		void record_rejected(id_t id, std::uint64_t bytes_in)
+		{
+			entry& target = at(id);
+			add(target.calls, 1);
+			add(target.rejected, 1);
+			add(target.bytes_in, bytes_in);
+		}
+
+		// adds what was recorded so far, called from any thread
+		void collect(metrics_snapshot& snapshot)
+		{
+			std::lock_guard lock(m_mutex);
+			for (const auto& [id, recorded] : m_entries) {
+				call_metrics& metrics = snapshot[id];
+				metrics.calls += recorded->calls.load(std::memory_order_relaxed);
+				metrics.errors += recorded->errors.load(std::memory_order_relaxed);
+				metrics.rejected += recorded->rejected.load(std::memory_order_relaxed);
+				metrics.bytes_in += recorded->bytes_in.load(std::memory_order_relaxed);
+				metrics.bytes_out += recorded->bytes_out.load(std::memory_order_relaxed);
+				for (std::size_t i = 0; i < latency_histogram::buckets; ++i) {
+					if (const std::uint64_t count = recorded->queueing[i].load(std::memory_order_relaxed))
+						metrics.queueing.record(latency_histogram::value_of(i), count);
+					if (const std::uint64_t count = recorded->execution[i].load(std::memory_order_relaxed))
+						metrics.execution.record(latency_histogram::value_of(i), count);
+				}
+				for (std::size_t i = 0; i < trace_stages::count; ++i) {
+					metrics.stages[i].allocations += recorded->stages[i].allocations.load(std::memory_order_relaxed);
+					metrics.stages[i].allocated_bytes += recorded->stages[i].allocated_bytes.load(std::memory_order_relaxed);
+					metrics.stages[i].copied_bytes += recorded->stages[i].copied_bytes.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+	private:
+		// only the owner writes, so there is nothing to lock
+		static void add(counter& value, std::uint64_t increment)
+		{
+			value.store(value.load(std::memory_order_relaxed) + increment, std::memory_order_relaxed);
+		}
+
+		static std::uint64_t nanoseconds_of(std::chrono::nanoseconds duration)
+		{
+			return static_cast<std::uint64_t>(duration.count() > 0 ? duration.count() : 0);
+		}
+
+		// the owner reads the map without the lock, nobody else changes it
+		entry& at(id_t id)
+		{
+			if (id == m_last_id)
+				return *m_last;
+			auto it = m_entries.find(id);
+			if (it == m_entries.end()) {
+				std::lock_guard lock(m_mutex);
+				it = m_entries.emplace(id, std::make_unique<entry>()).first;
+			}
+			m_last_id = id;
+			m_last = it->second.get();
+			return *m_last;
+		}
+	};
+
+	// shards of all threads recording for one server, merged on demand
+	class metrics_registry
+	{
+	private:
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<metrics_shard>> m_shards;
+		// what shards of finished threads recorded
+		metrics_snapshot m_retired;
+
+	public:
+		// shard for the calling thread, to be detached when it stops recording
+		metrics_shard& attach()
+		{
+			std::lock_guard lock(m_mutex);
+			m_shards.push_back(std::make_unique<metrics_shard>());
+			return *m_shards.back();
+		}
+		void detach(metrics_shard& shard)
+		{
+			std::lock_guard lock(m_mutex);
+			shard.collect(m_retired);
+			std::erase_if(m_shards, [&shard](const std::unique_ptr<metrics_shard>& attached) { return attached.get() == &shard; });
+		}
+
+		metrics_snapshot snapshot()
+		{
+			std::lock_guard lock(m_mutex);
+			metrics_snapshot snapshot = m_retired;
+			for (const std::unique_ptr<metrics_shard>& shard : m_shards)
+				shard->collect(snapshot);
+			return snapshot;
+		}
+	};
+
+	// measures one call and records it when it goes out of scope;
+	// a call that ends without a reply or rejection counts as an error
+	class call_sample
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		metrics_shard* m_shard;
+		const stage_accounting* m_accounting = nullptr;
+		id_t m_id;
+		std::uint64_t m_bytes_in;
+		std::uint64_t m_bytes_out = 0;
+		clock::time_point m_arrival;
+		clock::time_point m_start;
+		clock::time_point m_end = {};
+		bool m_failed = true;
+		bool m_rejected = false;
+
+	public:
+		// nothing is recorded without a shard or for null_id
+		call_sample(metrics_shard* shard, id_t id, clock::time_point arrival, std::uint64_t bytes_in)
+			: m_shard(shard), m_id(id), m_bytes_in(bytes_in), m_arrival(arrival), m_start(arrival) {}
+		~call_sample()
+		{
+			if (!m_shard || m_id == null_id)
+				return;
+			if (m_rejected) {
+				m_shard->record_rejected(m_id, m_bytes_in);
+				return;
+			}
+			if (m_end == clock::time_point{})
+				m_end = clock::now();
+			m_shard->record_call(m_id, m_bytes_in, m_bytes_out, m_failed, m_start - m_arrival, m_end - m_start, m_accounting);
+		}
+		call_sample(const call_sample&) = delete;
+		call_sample& operator=(const call_sample&) = delete;
+
+		// stages of the call are recorded along with it, accounting has to outlive the sample
+		void account(const stage_accounting& accounting) { m_accounting = &accounting; }
+		// the time since arrival was spent queueing
+		void start() { m_start = clock::now(); }
+		void reject() { m_rejected = true; }
+		void succeed(std::uint64_t bytes_out = 0)
+		{
+			m_end = clock::now();
+			m_bytes_out = bytes_out;
+			m_failed = false;
+		}
+		// sealed reply frame, the call failed unless its status is good
+		void reply(const misc::buffer<>& frame)
+		{
+			m_end = clock::now();
+			m_bytes_out = frame.size();
+			m_failed = frame.size() <= sizeof(frame_header) || frame.data()[sizeof(frame_header)] != status_codes::good;
+		}
+	};
+
+#pragma pack(push, 1)
+	// returned by builtin_functions::metrics for every id called so far, latencies are in nanoseconds
+	struct metrics_record
+	{
+		id_t id = null_id;
+		std::uint64_t calls = 0;
+		std::uint64_t errors = 0;
+		std::uint64_t rejected = 0;
+		std::uint64_t bytes_in = 0;
+		std::uint64_t bytes_out = 0;
+		std::uint64_t queueing_p50 = 0;
+		std::uint64_t queueing_p99 = 0;
+		std::uint64_t queueing_p999 = 0;
+		std::uint64_t queueing_max = 0;
+		std::uint64_t execution_p50 = 0;
+		std::uint64_t execution_p99 = 0;
+		std::uint64_t execution_p999 = 0;
+		std::uint64_t execution_max = 0;
+		// totals of every stage, indexed by trace_stages; zero unless the server counts with RPC_ACCOUNTING
+		std::uint64_t allocations[trace_stages::count] = {};
+		std::uint64_t allocated_bytes[trace_stages::count] = {};
+		std::uint64_t copied_bytes[trace_stages::count] = {};
+	};
+#pragma pack(pop)
+
+	inline std::vector<metrics_record> to_records(const metrics_snapshot& snapshot)
+	{
+		std::vector<metrics_record> records;
+		records.reserve(snapshot.size());
+		for (const auto& [id, metrics] : snapshot) {
+			metrics_record record;
+			record.id = id;
+			record.calls = metrics.calls;
+			record.errors = metrics.errors;
+			record.rejected = metrics.rejected;
+			record.bytes_in = metrics.bytes_in;
+			record.bytes_out = metrics.bytes_out;
+			record.queueing_p50 = metrics.queueing.percentile(0.5);
+			record.queueing_p99 = metrics.queueing.percentile(0.99);
+			record.queueing_p999 = metrics.queueing.percentile(0.999);
+			record.queueing_max = metrics.queueing.max();
+			record.execution_p50 = metrics.execution.percentile(0.5);
+			record.execution_p99 = metrics.execution.percentile(0.99);
+			record.execution_p999 = metrics.execution.percentile(0.999);
+			record.execution_max = metrics.execution.max();
+			for (std::size_t i = 0; i < trace_stages::count; ++i) {
+				record.allocations[i] = metrics.stages[i].allocations;
+				record.allocated_bytes[i] = metrics.stages[i].allocated_bytes;
+				record.copied_bytes[i] = metrics.stages[i].copied_bytes;
+			}
+			records.push_back(record);
+		}
+		return records;
+	}
+
+}
\ No newline at end of file
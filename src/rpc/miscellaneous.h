@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <functional>
 #include "../networking/miscellaneous.h"
+#include "frame.h"
 
 namespace rpc
 {
@@ -19,19 +20,19 @@ namespace rpc
 	};
 
 	template<typename Ret, typename ...Args>
-	struct function_meta_info<Ret __cdecl(Args...)> {
+	struct function_meta_info<Ret(Args...)> {
 		using return_type = std::decay_t<Ret>;
 		using arguments_types = std::tuple<std::decay_t<Args> ...>;
 	};
 
 	template<typename Ret, typename ...Args>
-	struct function_meta_info<Ret(__cdecl*)(Args...)> {
+	struct function_meta_info<Ret(*)(Args...)> {
 		using return_type = std::decay_t<Ret>;
 		using arguments_types = std::tuple<std::decay_t<Args> ...>;
 	};
 
 	template<typename S, typename Ret, typename ...Args>
-	struct function_meta_info<Ret(__thiscall S::*)(Args...)> {
+	struct function_meta_info<Ret(S::*)(Args...)> {
 		using return_type = std::decay_t<Ret>;
 		using arguments_types = std::tuple<std::decay_t<Args> ...>;
 	};
@@ -39,8 +40,18 @@ namespace rpc
 	using id_t = std::size_t;
 	using handle_t = std::uint16_t;
 
-	static id_t null_id = std::numeric_limits<id_t>::max();
-	static handle_t null_handle = std::numeric_limits<handle_t>::max();
+	const id_t null_id = std::numeric_limits<id_t>::max();
+	const handle_t null_handle = std::numeric_limits<handle_t>::max();
+
+	// functions every server provides, their ids are reserved
+	namespace builtin_functions
+	{
+		// std::vector<metrics_record> with the metrics of every function, method and type called so far
+		const id_t metrics = std::numeric_limits<id_t>::max() - 1;
+		// std::vector<schema_entry> with every registered function, method and type,
+		// fetched by clients when they connect
+		const id_t schema = std::numeric_limits<id_t>::max() - 2;
+	}
 
 	template<typename T, typename ...Args, typename std::size_t ...Indices>
 	T* new_tuple_invoker(const std::tuple<Args...>& tuple, std::index_sequence<Indices...>)
@@ -59,23 +70,62 @@ namespace rpc
 		const opcode_t call_function = 0;
 		const opcode_t call_method = 1;
 		const opcode_t create_object = 2;
+		// exchanges the features both sides of the connection agree to use
+		const opcode_t negotiate = 3;
+		// arguments and result are sent as streams of chunk frames
+		const opcode_t call_stream = 4;
+		// like call_function and call_method, with the 16-bit index the server's schema gave
+		// the function or method in place of its id
+		const opcode_t call_function_indexed = 5;
+		const opcode_t call_method_indexed = 6;
+	}
+
+	using features_t = std::uint32_t;
+	namespace features
+	{
+		const features_t none = 0;
+		const features_t compression = 1 << 0;
 	}
+
+	// payloads are compressed only on connections that negotiated it
+	// and only when they are at least threshold bytes long
+	struct compression_policy
+	{
+		bool enabled = false;
+		std::size_t threshold = 4 * net::kilobyte;
+	};
+	// header of the packet is left for the sender to seal with the call id;
+	// size of fixed-size arguments is a constant and small packets are stored inline
 	template<typename ...Args>
 	misc::buffer<> form_packet(opcode_t opcode, Args&&... args)
 	{
-		std::size_t size = misc::sizeof_v(args...) + sizeof opcode_t;
-		misc::buffer<> packet(size);
+		const std::size_t size = misc::encoded_size(args...) + sizeof(opcode_t);
+		misc::buffer<> packet = make_frame(size);
 		packet.add(opcode);
 		packet.add(args...);
 		return packet;
 	}
 
+	using function_flags_t = std::uint8_t;
+	namespace function_flags
+	{
+		const function_flags_t none = 0;
+		// result depends only on the arguments, replies are advertised as cacheable
+		const function_flags_t pure = 1 << 0;
+		// repeated calls with equal arguments may share one execution and its reply
+		const function_flags_t idempotent = 1 << 1;
+	}
+
 	using status_t = std::uint8_t;
 
 	namespace status_codes
 	{
 		const status_t good = 0;
 		const status_t bad = 1;
+		// deadline of the call passed or the caller cancelled it
+		const status_t cancelled = 2;
+		// server has no capacity for the call right now, the client should back off or try another replica
+		const status_t overloaded = 3;
 	}
 
 	using error_t = std::int32_t;
@@ -85,6 +135,10 @@ namespace rpc
 		const error_t no_error = 0;
 		const error_t connection_failure = 1;
 		const error_t bad_request = 2;
+		const error_t timeout = 3;
+		const error_t overloaded = 4;
+		// arguments don't match the signature the server registered, the call wasn't sent
+		const error_t signature_mismatch = 5;
 	}
 
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+namespace rpc
+{
+
+	// producers and the consumer touch different cache lines
+	constexpr std::size_t cache_line_size = 64;
+
+	// link embedded in the queued objects, the queue never allocates
+	struct mpsc_node
+	{
+		std::atomic<mpsc_node*> next = nullptr;
+	};
+
+	// intrusive lock-free multi-producer single-consumer queue (Vyukov):
+	// push is one exchange and one store from any thread, pop is called by a single consumer thread
+	class mpsc_queue
+	{
+	private:
+		alignas(cache_line_size) std::atomic<mpsc_node*> m_head;
+		alignas(cache_line_size) mpsc_node* m_tail;
+		mpsc_node m_stub;
+
+	public:
+		mpsc_queue() : m_head(&m_stub), m_tail(&m_stub) {}
+		mpsc_queue(const mpsc_queue&) = delete;
+		mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+		void push(mpsc_node* node)
+		{
+			node->next.store(nullptr, std::memory_order_relaxed);
+			mpsc_node* previous = m_head.exchange(node, std::memory_order_acq_rel);
+			previous->next.store(node, std::memory_order_release);
+		}
+
+		// oldest node or nullptr if the queue is empty
+		mpsc_node* pop()
+		{
+			while (true) {
+				mpsc_node* tail = m_tail;
+				mpsc_node* next = tail->next.load(std::memory_order_acquire);
+				if (tail == &m_stub) {
+					if (!next) {
+						if (m_head.load(std::memory_order_acquire) == &m_stub)
+							return nullptr;
+						// a producer swapped the head but did not link its node yet
+						std::this_thread::yield();
+						continue;
+					}
+					m_tail = next;
+					tail = next;
+					next = next->next.load(std::memory_order_acquire);
+				}
+				if (next) {
+					m_tail = next;
+					return tail;
+				}
+				if (tail != m_head.load(std::memory_order_acquire)) {
+					std::this_thread::yield();
+					continue;
+				}
+				// tail is the last node, the stub goes behind it so tail can be handed out
+				push(&m_stub);
+				next = tail->next.load(std::memory_order_acquire);
+				if (next) {
+					m_tail = next;
+					return tail;
+				}
+				std::this_thread::yield();
+			}
+		}
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+#include "miscellaneous.h"
+
+namespace rpc
+{
+
+	// fingerprint of how a list of types is laid out on the wire; built from the structure of the types
+	// (kind, size, signedness, element type of containers), not their names, so both sides agree
+	// whatever compiler built them and types serialized alike (std::string, std::vector<char>) match
+	using signature_t = std::uint64_t;
+
+	// dense number of a registered function, method or type in the table of one server
+	using index_t = std::uint16_t;
+	const index_t null_index = std::numeric_limits<index_t>::max();
+
+	using schema_kind_t = std::uint8_t;
+	namespace schema_kinds
+	{
+		const schema_kind_t function = 0;
+		const schema_kind_t method = 1;
+		const schema_kind_t type = 2;
+		// arguments and result are streams, their signatures are not known
+		const schema_kind_t stream = 3;
+	}
+
+	namespace detail
+	{
+		constexpr signature_t mix(signature_t seed, signature_t value)
+		{
+			// boost::hash_combine widened to 64 bits
+			return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 12) + (seed >> 4));
+		}
+	}
+
+	template<typename T>
+	constexpr signature_t type_signature()
+	{
+		using type = std::decay_t<T>;
+		if constexpr (std::is_void_v<type>) {
+			return 0x766f6964;
+		}
+		else if constexpr (misc::is_iterable<type>::value) {
+			return detail::mix(0x636f6e74, type_signature<typename type::value_type>());
+		}
+		else if constexpr (std::is_arithmetic_v<type>) {
+			return detail::mix(0x61726974, (std::is_floating_point_v<type> ? 1u : 0u) | (std::is_signed_v<type> ? 2u : 0u) | (sizeof(type) << 2));
+		}
+		else {
+			return detail::mix(0x706f64, sizeof(type));
+		}
+	}
+
+	template<typename ...Args>
+	constexpr signature_t arguments_signature()
+	{
+		signature_t signature = sizeof...(Args);
+		((signature = detail::mix(signature, type_signature<Args>())), ...);
+		return signature;
+	}
+
+	template<typename>
+	struct tuple_signature;
+	template<typename ...Args>
+	struct tuple_signature<std::tuple<Args...>>
+	{
+		static constexpr signature_t value = arguments_signature<Args...>();
+	};
+
+#pragma pack(push, 1)
+	// one row of the table returned by builtin_functions::schema
+	struct schema_entry
+	{
+		id_t id = null_id;
+		index_t index = 0;
+		schema_kind_t kind = schema_kinds::function;
+		signature_t arguments = 0;
+		// of the value returned, 0 for types and streams
+		signature_t result = 0;
+	};
+#pragma pack(pop)
+
+}
\ No newline at end of file
@@ -2,9 +2,30 @@
 
 #include "../networking/socket.h"
 #include "miscellaneous.h"
+#include "frame.h"
+#include "cache.h"
+#include "single_flight.h"
+#include "stream.h"
+#include "generator.h"
+#include "channel.h"
+#include "deadline.h"
+#include "admission.h"
+#include "shard.h"
+#include "timing_wheel.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "schema.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <thread>
+#include <vector>
 #include <new>
 
 namespace rpc
@@ -30,47 +51,99 @@ namespace rpc
 				std::cout << "Something happened while creating socket for server\n";
 				return false;
 			}
+			listener_open = true;
+			listen_address = address;
 			(register_function(pairs.first, pairs.second), ...);
+			register_function(builtin_functions::metrics, [this]() { return to_records(metrics.snapshot()); });
+			register_function(builtin_functions::schema, [this]() { return schema; });
 			return true;
 		}
 
 		template<typename Func>
-		void register_function(std::string_view func_name, Func&& func)
+		void register_function(std::string_view func_name, Func&& func, function_flags_t flags = function_flags::none)
 		{
-			register_function(std::hash<std::string_view>{}(func_name), std::move(func));
+			register_function(std::hash<std::string_view>{}(func_name), std::forward<Func>(func), flags);
 		}
 		template<typename Func>
-		void register_function(const id_t func_id, Func&& func)
+		void register_function(const id_t func_id, Func&& func, function_flags_t flags = function_flags::none)
 		{
-			auto lambda = [this, &func](misc::buffer<>& buffer) -> misc::buffer<>
+			using meta_info = function_meta_info<decltype(std::function{ func })>;
+			using return_type = typename meta_info::return_type;
+			if constexpr (is_generator<return_type>::value) {
+				register_generator(func_id, std::forward<Func>(func));
+			}
+			else {
+				auto lambda = [this, func = std::forward<Func>(func)](misc::buffer<>& buffer) -> misc::buffer<>
+				{
+					std::function f{ func };
+					using meta_info = function_meta_info<decltype(f)>;
+					using args_types_tuple = typename meta_info::arguments_types;
+					args_types_tuple args;
+
+					unpack(args, buffer, std::make_index_sequence<std::tuple_size_v<args_types_tuple>>{});
+					this_trace::mark(trace_stages::unpack);
+
+					return apply(f, std::move(args));
+				};
+
+				auto [it, added] = functions.emplace(func_id, registered_function{ std::move(lambda), flags });
+				if (added) {
+					function_slots.push_back({ func_id, &it->second });
+					add_to_schema(func_id, schema_kinds::function, function_slots.size() - 1,
+						tuple_signature<typename meta_info::arguments_types>::value, type_signature<return_type>());
+				}
+			}
+		}
+
+		// items yielded by the function are streamed to the client as they are produced,
+		// packed arguments arrive as the first item of the argument stream
+		template<typename Func>
+		void register_generator(const id_t func_id, Func&& func)
+		{
+			auto handler = [this, func = std::forward<Func>(func)](stream_reader& input, stream_writer& output)
 			{
 				std::function f{ func };
 				using meta_info = function_meta_info<decltype(f)>;
-				using ret_type = typename meta_info::return_type;
 				using args_types_tuple = typename meta_info::arguments_types;
 				args_types_tuple args;
 
-				unpack(args, buffer, std::make_index_sequence<std::tuple_size_v<args_types_tuple>>{});
+				const std::span<const std::uint8_t> packed = input.next();
+				misc::buffer<> arguments(packed.size());
+				arguments.add(packed.data(), packed.size());
+				unpack(args, arguments, std::make_index_sequence<std::tuple_size_v<args_types_tuple>>{});
 
-				return apply(f, std::move(args));
+				for (const auto& item : std::apply(f, std::move(args))) {
+					if (!output.write_item(item))
+						break;
+				}
 			};
+			register_stream_function(func_id, std::move(handler));
+		}
 
-			functions.emplace(func_id, std::move(lambda));
+		// handler reads the argument stream and writes the result stream chunk by chunk,
+		// so neither has to fit in memory
+		void register_stream_function(std::string_view func_name, stream_function func)
+		{
+			register_stream_function(std::hash<std::string_view>{}(func_name), std::move(func));
+		}
+		void register_stream_function(const id_t func_id, stream_function func)
+		{
+			if (stream_functions.emplace(func_id, std::move(func)).second)
+				add_to_schema(func_id, schema_kinds::stream, null_index, 0, 0);
 		}
+
 		template<typename ...Args, typename std::size_t ...Indices>
 		void unpack(std::tuple<Args...>& tuple, misc::buffer<>& buffer, std::index_sequence<Indices...>)
 		{
-			auto unpack_one_parameter = [counter = 0, &buffer](auto& value) mutable
+			[[maybe_unused]] auto unpack_one_parameter = [counter = 0, &buffer](auto& value) mutable
 			{
 				using T = std::decay_t<decltype(value)>;
 
 				if constexpr (misc::is_iterable<T>::value) {
-					using value_type = T::value_type;
-					std::size_t size = misc::get<std::size_t>(buffer.data(), counter);
-					value_type *data = static_cast<value_type*>(misc::get(buffer.data(), size, counter));
-					//creating container from buffered data
-					value = T(data, data + size / sizeof value_type);
-					delete[] data;
+					const std::size_t size = misc::get<std::size_t>(buffer.data() + counter, 0);
+					//creating container straight from buffered data
+					misc::decode_into(buffer.data() + counter, buffer.size() - counter, value);
+					counter += sizeof(std::size_t) + size;
 				}
 				if constexpr (!misc::is_iterable<T>::value)
 					value = misc::get<T>(buffer.data(), counter);
@@ -88,13 +161,15 @@ namespace rpc
 
 			if constexpr (std::is_same_v<return_type, void>) {
 				std::apply(function, std::move(args...));
-				misc::buffer<> ret_buffer(sizeof status_t);
+				this_trace::mark(trace_stages::execute);
+				misc::buffer<> ret_buffer = make_frame(sizeof(status_t));
 				ret_buffer.add(status_codes::good);
 				return ret_buffer;
 			}
 			else {
 				return_type ret_value = std::apply(function, std::move(args...));
-				misc::buffer<> ret_buffer(sizeof status_t + misc::sizeof_v(ret_value));
+				this_trace::mark(trace_stages::execute);
+				misc::buffer<> ret_buffer = make_frame(sizeof(status_t) + misc::encoded_size(ret_value));
 				ret_buffer.add(status_codes::good);
 				ret_buffer.add(ret_value);
 				return ret_buffer;
@@ -112,14 +187,14 @@ namespace rpc
 			auto alloc_and_init = [this](misc::buffer<>& arguments) -> void*
 			{
 				using meta = function_meta_info<decltype(init)>;
-				using ret_type = meta::return_type;
 				using args_types_tuple = meta::arguments_types;
 				args_types_tuple args;
 
 				unpack(args, arguments, std::make_index_sequence<std::tuple_size_v<args_types_tuple>>{});
 				return static_cast<void*>(new_tuple<T>(args));
 			};
-			types.emplace(type_id, alloc_and_init);
+			if (types.emplace(type_id, alloc_and_init).second)
+				add_to_schema(type_id, schema_kinds::type, null_index, arguments_signature<std::decay_t<Args>...>(), 0);
 		}
 
 		template<typename Ret, typename T, typename ...Args>
@@ -132,14 +207,14 @@ namespace rpc
 			auto lambda = [this, m_method = g_method](void* object_v, misc::buffer<>& arguments) -> misc::buffer<>
 			{
 				//copying member function pointer to eliminate a bug with losing its value
-				Ret(__thiscall T:: * method)(Args...) = m_method; 
+				Ret(T::* method)(Args...) = m_method;
 				using class_type = T;
 				using meta = function_meta_info<decltype(g_method)>;
-				using ret_type = meta::return_type;
 				using args_types_tuple = meta::arguments_types;
 				args_types_tuple args;
 
 				unpack(args, arguments, std::make_index_sequence<std::tuple_size_v<args_types_tuple>>{});
+				this_trace::mark(trace_stages::unpack);
 
 				class_type* object = static_cast<class_type*>(object_v);
 				assert(object != nullptr);
@@ -150,94 +225,898 @@ namespace rpc
 				//ret_buffer.add(ret_val);
 				return apply(caller, std::move(args));
 			};
-			methods.emplace(method_id, lambda);
+			auto [it, added] = methods.emplace(method_id, lambda);
+			if (added) {
+				method_slots.push_back({ method_id, &it->second });
+				add_to_schema(method_id, schema_kinds::method, method_slots.size() - 1,
+					arguments_signature<std::decay_t<Args>...>(), type_signature<Ret>());
+			}
 		}
 
+		// rows of builtin_functions::schema, in the order of registration
+		const std::vector<schema_entry>& registered_schema() const { return schema; }
+
+		// accepts clients until stopped, every client is served on its own thread;
+		// threads of clients that left are joined as new ones arrive
 		void run()
 		{
-			misc::buffer<> buffer(10 * net::kilobyte);
+			while (!is_stopped) {
+				net::socket<net::protocols::TCP> connection;
+				if (!socket.accept(connection)) {
+					if (!is_stopped)
+						std::cout << "Something happened while accepting new client in run method of server\n";
+					break;
+				}
+				std::cout << "New client accepted\n";
 
-			if (socket.accept() == false) {
-				std::cout << "Something happened while accepting new client in run method of server\n";
-				int error_code = WSAGetLastError();
-				std::cout << "Error code: " << error_code << '\n';
+				std::lock_guard lock(connections_mutex);
+				// stop may have shut the connections down already
+				if (is_stopped) {
+					connection.close();
+					break;
+				}
+				reap_connections();
+				auto served = std::make_unique<served_connection>();
+				served->handle = connection.native_handle();
+				served->thread = std::thread([this, connection, &finished = served->finished]() {
+					serve(connection);
+					finished = true;
+				});
+				connections.push_back(std::move(served));
 			}
-			while (!is_stopped) {
-				auto return_code = socket.receive(buffer.data_nc(), buffer.capacity());
-				if (return_code == 0) {
-					std::cout << "Received 0 bytes of information\n";
-					continue;
+
+			std::vector<std::unique_ptr<served_connection>> remaining;
+			{
+				std::lock_guard lock(connections_mutex);
+				remaining.swap(connections);
+			}
+			for (std::unique_ptr<served_connection>& connection : remaining) {
+				connection->thread.join();
+				net::close_socket(connection->handle);
+			}
+		}
+
+		// makes run or run_sharded return: the listening socket is closed and the connections shut down,
+		// calls being executed still finish. May be called from any thread, a handler included;
+		// the server can't be run again
+		void stop()
+		{
+			if (is_stopped.exchange(true))
+				return;
+			{
+				std::lock_guard lock(connections_mutex);
+				close_listener();
+				for (std::unique_ptr<served_connection>& connection : connections) {
+					if (!connection->finished)
+						net::shutdown_socket(connection->handle);
 				}
-				else if (return_code < 0) {
-					std::cout << "Something has happened with server socket while receiving client call\n";
-					int error_code = WSAGetLastError();
-					std::cout << "Error code: " << error_code << '\n';
+			}
+			// reactors check the flag once woken up
+			for (std::unique_ptr<shard>& self : shards)
+				self->inbox.post([]() {});
+		}
+
+		// alternative to run: one reactor per core, each accepting on its own SO_REUSEPORT socket and
+		// serving its connections one frame at a time on a single pinned thread, so shards share nothing
+		// but read-only registrations and the admission controller; where the port can't be shared, shard 0
+		// accepts for all of them and hands connections over through their mailboxes. Calls are never queued
+		// for admission here (see admission_controller::try_acquire): limits are shared by all reactors and
+		// priorities decide which calls are shed first once the backlog of a reactor grows
+		void run_sharded(const shard_policy& policy = {})
+		{
+			const std::size_t count = policy.shards ? policy.shards : std::max(1u, std::thread::hardware_concurrency());
+			shards.clear();
+			for (std::size_t i = 0; i < count; ++i)
+				shards.push_back(std::make_unique<shard>(policy.timer_tick));
+
+			// the socket created for run can't share its port, every shard opens its own
+			{
+				std::lock_guard lock(connections_mutex);
+				close_listener();
+			}
+			shared_port = true;
+			for (std::unique_ptr<shard>& self : shards) {
+				if (!self->listener.create(listen_address, true)) {
+					shared_port = false;
 					break;
 				}
+				self->listening = true;
+			}
+			if (!shared_port) {
+				for (std::unique_ptr<shard>& self : shards) {
+					if (self->listening)
+						self->listener.close();
+					self->listening = false;
+				}
+				if (!shards[0]->listener.create(listen_address)) {
+					std::cout << "Something happened while creating socket for server\n";
+					return;
+				}
+				shards[0]->listening = true;
+			}
 
-				buffer.set_size(return_code);
+			sharded = true;
+			std::vector<std::thread> reactors;
+			for (std::size_t i = 0; i < count; ++i)
+				reactors.emplace_back(&server::run_shard, this, i, policy);
+			for (std::thread& reactor : reactors)
+				reactor.join();
+			sharded = false;
+		}
 
-				const std::uint8_t* data = buffer.data();
-				const opcode_t opcode = misc::get<opcode_t>(data, 0);
-				buffer.left_shift(sizeof opcode_t);
+		std::size_t shard_count() const { return shards.size(); }
 
-				misc::buffer<> return_buffer;
-				switch (opcode) {
-				case opcodes::call_function: {
-					const id_t func_id = misc::get<id_t>(data, 0);
-					buffer.left_shift(sizeof id_t);
-					return_buffer = call_function(func_id, buffer);
+		// runs the task on the reactor thread of the shard, the way for shards to talk to each other;
+		// valid while run_sharded runs
+		bool post(std::size_t shard_index, mailbox::task work)
+		{
+			if (shard_index >= shards.size())
+				return false;
+			shards[shard_index]->inbox.post(std::move(work));
+			return true;
+		}
+
+		void serve(net::socket<net::protocols::TCP> connection)
+		{
+			net::set_no_delay(connection.native_handle());
+			connection_state state(connection, flow_control);
+			state.link.set_busy_poll_policy(busy_poll);
+			attach_capture(state.link);
+			state.metrics = &metrics.attach();
+			if (state.link.announce_window()) {
+				while (!is_stopped && await_frame(state) && handle_burst(state)) {}
+			}
+			metrics.detach(*state.metrics);
+		}
+
+		// a connection served on its own thread by run, the socket is closed once the thread is joined,
+		// so stop never shuts down a handle that was reused meanwhile
+		struct served_connection
+		{
+			std::thread thread;
+			socket_t handle;
+			std::atomic<bool> finished = false;
+		};
+
+		// called with connections_mutex held, shutting down first wakes up run blocked in accept
+		void close_listener()
+		{
+			if (!listener_open)
+				return;
+			net::shutdown_socket(socket.listening_handle());
+			socket.close();
+			listener_open = false;
+		}
+
+		// called with connections_mutex held
+		void reap_connections()
+		{
+			std::erase_if(connections, [](const std::unique_ptr<served_connection>& connection) {
+				if (!connection->finished)
+					return false;
+				connection->thread.join();
+				net::close_socket(connection->handle);
+				return true;
+			});
+		}
+
+		// what a served connection keeps between its frames
+		struct connection_state
+		{
+			channel link;
+			misc::buffer<> buffer;
+			features_t negotiated = features::none;
+			// keepalive check of a connection served by a reactor, which sets expired instead of closing it
+			timing_wheel::timer keepalive;
+			bool expired = false;
+			// failed or closed by the peer, removed by the reactor at the end of its round
+			bool closed = false;
+			// queued for the current or next round of its reactor
+			bool scheduled = false;
+			// of the thread serving the connection
+			metrics_shard* metrics = nullptr;
+
+			connection_state(const net::socket<net::protocols::TCP>& connection, const std::atomic<flow_control_policy>& policy)
+				: link(connection, policy), buffer(10 * net::kilobyte) {}
+		};
+
+		void attach_capture(channel& link)
+		{
+			std::lock_guard lock(capture_mutex);
+			if (capture && capture->is_running())
+				link.set_capture(capture, next_captured_connection++);
+		}
+
+		// next time the keepalive of the connection is due, nullopt once it should be closed
+		// and duration::max if the policy doesn't need it
+		std::optional<channel::clock::duration> check_keepalive(connection_state& state)
+		{
+			const channel::clock::duration silent = channel::clock::now() - state.link.last_receive();
+			channel::clock::duration next = channel::clock::duration::max();
+			if (keepalive.idle_timeout.count() > 0) {
+				if (silent >= keepalive.idle_timeout)
+					return std::nullopt;
+				next = keepalive.idle_timeout - silent;
+			}
+			if (keepalive.heartbeat_interval.count() > 0) {
+				if (silent < keepalive.heartbeat_interval)
+					next = std::min<channel::clock::duration>(next, keepalive.heartbeat_interval - silent);
+				else if (state.link.send_ping() && state.link.flush())
+					next = std::min<channel::clock::duration>(next, keepalive.heartbeat_interval);
+				else
+					return std::nullopt;
+			}
+			return next;
+		}
+
+		// waits for the next frame of a connection with its own thread, pinging the peer meanwhile;
+		// false once the connection should be closed
+		bool await_frame(connection_state& state)
+		{
+			while (true) {
+				const std::optional<channel::clock::duration> next = check_keepalive(state);
+				if (!next)
+					return false;
+				const std::chrono::microseconds timeout = (*next == channel::clock::duration::max())
+					? std::chrono::microseconds(-1) : std::chrono::ceil<std::chrono::microseconds>(*next);
+				const int ready = state.link.wait(timeout);
+				if (ready == -2)
+					return false;
+				if (ready == 0)
+					return true;
+			}
+		}
+
+		// calls that already arrived are handled in one go and their replies written with one send,
+		// at most max_burst of them so a busy connection can't delay its reactor's other connections forever
+		bool handle_burst(connection_state& state)
+		{
+			state.link.cork();
+			bool open = true;
+			for (std::size_t handled = 0; open && handled < max_burst; ++handled) {
+				// a readable socket may hold only frames for the channel itself, such as pongs,
+				// receiving would then block until the next call
+				if (!state.link.poll()) {
+					std::cout << "Something has happened with server socket while receiving client call\n";
+					int error_code = net::last_error();
+					std::cout << "Error code: " << error_code << '\n';
+					open = false;
 					break;
 				}
-				case opcodes::call_method: {
-					const id_t func_id = misc::get<id_t>(data, 0);
-					buffer.left_shift(sizeof id_t);
-					const id_t object_id = misc::get<id_t>(data, 0);
-					buffer.left_shift(sizeof id_t);
-					return_buffer = call_method(func_id, object_id, buffer);
+				if (!state.link.has_pending())
 					break;
+				open = handle_frame(state);
+			}
+			return state.link.uncork() && open;
+		}
+
+		// receives and executes one call, false once the connection should be closed
+		bool handle_frame(connection_state& state)
+		{
+			channel& link = state.link;
+			misc::buffer<>& buffer = state.buffer;
+			features_t& negotiated = state.negotiated;
+
+			// receiving is charged to the receive stage of the call
+			const misc::accounting::counters before_receive = misc::accounting::thread_counters();
+			// cancels arriving between calls are for calls already answered
+			link.end_call();
+			frame_header header;
+			if (!link.receive(header, buffer)) {
+				std::cout << "Something has happened with server socket while receiving client call\n";
+				int error_code = net::last_error();
+				std::cout << "Error code: " << error_code << '\n';
+				return false;
+			}
+			// arguments of a stream call that was cancelled before it started
+			if (header.flags & (frame_flags::stream_chunk | frame_flags::stream_end)) {
+				if (header.flags & frame_flags::stream_chunk)
+					link.consume(header.size);
+				return true;
+			}
+			// calls traced by the client are traced here as well, the rest is sampled anew
+			trace_span span(tracing, header.trace_id ? header.trace_id : tracing.sample(), null_id, link.arrival());
+			const trace_scope traced(span);
+			span.accounting().account_from(before_receive);
+			span.mark(trace_stages::receive);
+
+			const std::uint8_t* data = buffer.data();
+			const opcode_t opcode = misc::get<opcode_t>(data, 0);
+			buffer.left_shift(sizeof(opcode_t));
+			const id_t target = target_of(opcode, data);
+			call_sample sample(state.metrics, target, link.arrival(), sizeof(frame_header) + header.size);
+			sample.account(span.accounting());
+			span.set_call(header.call_id, target);
+			span.mark(trace_stages::decode);
+
+			// the caller has given up already, nobody would read the reply;
+			// stream calls still run to consume their arguments and report the status
+			const deadline_clock::time_point deadline = deadline_of(header, link.arrival());
+			if (opcode != opcodes::call_stream && deadline_clock::now() >= deadline) {
+				sample.reject();
+				return true;
+			}
+
+			// slot of an admitted call is held until its reply is sent
+			std::optional<admission_ticket> ticket;
+			if (opcode == opcodes::call_function || opcode == opcodes::call_method
+				|| opcode == opcodes::call_function_indexed || opcode == opcodes::call_method_indexed) {
+				const id_t func_id = target;
+				// a reactor of a sharded server must not block its other connections waiting for a slot,
+				// its calls are admitted or shed right away by how long they waited in its backlog
+				const bool admitted = sharded ? admission.try_acquire(func_id, channel::clock::now() - link.arrival())
+					: admission.acquire(func_id, deadline);
+				if (!admitted) {
+					sample.reject();
+					if (!send_status(link, header.call_id, status_codes::overloaded))
+						std::cout << "Some error occured while sending return value to client\n";
+					return true;
+				}
+				ticket.emplace(admission, func_id);
+			}
+
+			sample.start();
+			link.begin_call(header.call_id);
+			const cancellation_token token(link, deadline);
+			const call_scope scope(token);
+
+			misc::buffer<> return_buffer;
+			frame_flags_t reply_flags = frame_flags::none;
+			// an index the server never gave out
+			if (target == null_id && (opcode == opcodes::call_function_indexed || opcode == opcodes::call_method_indexed)) {
+				if (!send_status(link, header.call_id, status_codes::bad))
+					std::cout << "Some error occured while sending return value to client\n";
+				return true;
+			}
+			switch (opcode) {
+			case opcodes::call_function:
+			case opcodes::call_function_indexed: {
+				const id_t func_id = target;
+				const index_t index = (opcode == opcodes::call_function_indexed) ? misc::get<index_t>(data, 0) : null_index;
+				buffer.left_shift((opcode == opcodes::call_function_indexed) ? sizeof(index_t) : sizeof(id_t));
+				if (is_idempotent(func_id)) {
+					// encoded reply is shared with the cache, only the header is written anew
+					shared_response response = call_function_coalesced(func_id, buffer);
+					if (token.is_cancelled())
+						return true;
+					sample.reply(*response);
+					span.mark(trace_stages::encode);
+					if (!send_shared(link, negotiated, header.call_id, *response))
+						std::cout << "Some error occured while sending return value to client\n";
+					span.mark(trace_stages::send);
+					return true;
+				}
+				return_buffer = (index != null_index) ? call_function_at(index, buffer) : call_function(func_id, buffer);
+				reply_flags = reply_flags_of(func_id);
+				break;
+			}
+			case opcodes::call_method:
+			case opcodes::call_method_indexed: {
+				const index_t index = (opcode == opcodes::call_method_indexed) ? misc::get<index_t>(data, 0) : null_index;
+				buffer.left_shift((opcode == opcodes::call_method_indexed) ? sizeof(index_t) : sizeof(id_t));
+				const id_t object_id = misc::get<id_t>(data, 0);
+				buffer.left_shift(sizeof(id_t));
+				return_buffer = (index != null_index) ? call_method_at(index, object_id, buffer) : call_method(target, object_id, buffer);
+				break;
+			}
+			case opcodes::create_object: {
+				const id_t type_id = misc::get<id_t>(data, 0);
+				buffer.left_shift(sizeof(id_t));
+				const id_t name_id = misc::get<id_t>(data, 0);
+				buffer.left_shift(sizeof(id_t));
+				create_object(type_id, name_id, buffer);
+				break;
+			}
+			case opcodes::call_stream: {
+				const id_t func_id = misc::get<id_t>(data, 0);
+				span.mark(trace_stages::lookup);
+				if (!call_stream(link, negotiated, header.call_id, func_id, token)) {
+					std::cout << "Some error occured while streaming a call\n";
+					return false;
+				}
+				if (!token.is_cancelled())
+					sample.succeed();
+				span.mark(trace_stages::execute);
+				return true;
+			}
+			case opcodes::negotiate: {
+				const features_t requested = misc::get<features_t>(data, 0);
+				negotiated = requested & supported_features();
+				return_buffer = make_frame(sizeof(status_t) + sizeof(features_t));
+				return_buffer.add(status_codes::good, negotiated);
+				break;
+			}
+			}
+
+			if (token.is_cancelled())
+				return true;
+			if (return_buffer.is_empty()) {
+				sample.succeed();
+				return true;
+			}
+			seal_frame(return_buffer, header.call_id, reply_flags);
+			sample.reply(return_buffer);
+			span.mark(trace_stages::encode);
+			if (!send_frame(link, negotiated, return_buffer))
+				std::cout << "Some error occured while sending return value to client\n";
+			span.mark(trace_stages::send);
+			return true;
+		}
+
+		// connections, listening socket, mailbox and timers of one reactor, touched only by its thread
+		struct shard
+		{
+			net::socket<net::protocols::TCP, true> listener;
+			bool listening = false;
+			mailbox inbox;
+			// inbox, listener and connections are registered once, not gathered for every wait
+			net::poller poller;
+			metrics_shard* metrics = nullptr;
+			// declared before the connections, whose timers it holds
+			timing_wheel timers;
+			std::vector<std::unique_ptr<connection_state>> connections;
+
+			explicit shard(std::chrono::microseconds timer_tick) : timers(timer_tick) {}
+		};
+
+		// keys the poller of a reactor reports its sockets by, connections go by their state's address
+		static constexpr std::uint64_t inbox_key = 0;
+		static constexpr std::uint64_t listener_key = 1;
+
+		void run_shard(std::size_t index, shard_policy policy)
+		{
+			// pinned before anything is allocated, so buffers land on the local NUMA node
+			if (policy.pin_threads && !pin_current_thread(policy.first_cpu + index))
+				std::cout << "Failed to pin the reactor of shard " << index << " to its cpu\n";
+			this_shard::detail::index = index;
+
+			shard& self = *shards[index];
+			self.metrics = &metrics.attach();
+			bool open = self.poller.is_open() && self.poller.add(self.inbox.handle(), inbox_key)
+				&& (!self.listening || self.poller.add(self.listener.listening_handle(), listener_key));
+			if (!open) {
+				std::cout << "Something happened while setting up the poller of shard " << index << '\n';
+				int error_code = net::last_error();
+				std::cout << "Error code: " << error_code << '\n';
+			}
+			std::size_t next_shard = 0;
+			std::vector<std::uint64_t> ready;
+			// connections served in this round, and those with frames left queued after their burst,
+			// which get the next round; every connection gets one burst per round
+			std::vector<connection_state*> round;
+			std::vector<connection_state*> backlog;
+			while (open && !is_stopped) {
+				// expired connections are closed with the others at the end of the round
+				self.timers.advance();
+
+				// frames queued by a channel don't make its socket readable, so the wait doesn't block then;
+				// otherwise it sleeps until the next timer at most
+				const timing_wheel::clock::duration until_timer = self.timers.until_next();
+				const std::chrono::microseconds timeout = !backlog.empty() ? std::chrono::microseconds(0)
+					: (until_timer.count() < 0) ? std::chrono::microseconds(-1) : std::chrono::ceil<std::chrono::microseconds>(until_timer);
+				int count = 0;
+				if (busy_poll.enabled && backlog.empty()) {
+					const auto spin_start = channel::clock::now();
+					do {
+						count = self.poller.wait(ready, std::chrono::microseconds(0));
+					} while (count == 0 && channel::clock::now() - spin_start < busy_poll.spin);
 				}
-				case opcodes::create_object: {
-					const id_t type_id = misc::get<id_t>(data, 0);
-					buffer.left_shift(sizeof id_t);
-					const id_t name_id = misc::get<id_t>(data, 0);
-					buffer.left_shift(sizeof id_t);
-					create_object(type_id, name_id, buffer);
+				if (count == 0)
+					count = self.poller.wait(ready, timeout);
+				if (count < 0) {
+					std::cout << "Something happened while waiting for clients in shard " << index << '\n';
+					int error_code = net::last_error();
+					std::cout << "Error code: " << error_code << '\n';
 					break;
 				}
+
+				round.swap(backlog);
+				backlog.clear();
+				for (const std::uint64_t key : ready) {
+					if (key == inbox_key) {
+						self.inbox.run();
+						continue;
+					}
+					if (key == listener_key) {
+						accept_connection(self, index, next_shard);
+						continue;
+					}
+					connection_state* connection = reinterpret_cast<connection_state*>(key);
+					if (!connection->scheduled) {
+						connection->scheduled = true;
+						round.push_back(connection);
+					}
 				}
 
-				if (return_buffer.is_empty())
-					continue;
-				if (!socket.send(return_buffer.data(), return_buffer.size())) {
-					std::cout << "Some error occured while sending return value to client\n";
-					continue;
+				for (connection_state* connection : round) {
+					connection->scheduled = false;
+					if (connection->expired || connection->closed)
+						continue;
+					if (!handle_burst(*connection)) {
+						connection->closed = true;
+						continue;
+					}
+					if (connection->link.has_pending()) {
+						connection->scheduled = true;
+						backlog.push_back(connection);
+					}
 				}
+				round.clear();
+
+				// backlog holds none of them, they are not scheduled once closed or expired
+				std::erase_if(self.connections, [&self](const std::unique_ptr<connection_state>& connection) {
+					if (!connection->expired && !connection->closed)
+						return false;
+					self.poller.remove(connection->link.socket().native_handle());
+					connection->link.socket().close();
+					return true;
+				});
+			}
+
+			for (std::unique_ptr<connection_state>& connection : self.connections)
+				connection->link.socket().close();
+			self.connections.clear();
+			if (self.listening)
+				self.listener.close();
+			self.listening = false;
+			metrics.detach(*self.metrics);
+		}
+
+		void accept_connection(shard& self, std::size_t index, std::size_t& next_shard)
+		{
+			net::socket<net::protocols::TCP> connection;
+			if (!self.listener.accept(connection))
+				return;
+			const std::size_t target = shared_port ? index : next_shard++ % shards.size();
+			if (target == index)
+				add_connection(self, connection);
+			else
+				shards[target]->inbox.post([this, target, connection]() { add_connection(*shards[target], connection); });
+		}
 
+		void add_connection(shard& self, const net::socket<net::protocols::TCP>& connection)
+		{
+			net::set_no_delay(connection.native_handle());
+			if (busy_poll.enabled && busy_poll.kernel_spin.count() > 0)
+				net::set_busy_poll(connection.native_handle(), busy_poll.kernel_spin);
+			// the reactor spins on all of its sockets at once, not on every connection
+			auto state = std::make_unique<connection_state>(connection, flow_control);
+			state->metrics = self.metrics;
+			attach_capture(state->link);
+			if (!state->link.announce_window()
+				|| !self.poller.add(connection.native_handle(), reinterpret_cast<std::uint64_t>(state.get()))) {
+				state->link.socket().close();
+				return;
 			}
+			connection_state& added = *state;
+			self.connections.push_back(std::move(state));
+
+			// one timer per connection, rescheduled from its last receive instead of on every frame
+			added.keepalive.callback = [this, &self, &added]() {
+				const std::optional<channel::clock::duration> next = check_keepalive(added);
+				if (!next)
+					added.expired = true;
+				else if (*next != channel::clock::duration::max())
+					self.timers.schedule(added.keepalive, *next);
+			};
+			added.keepalive.callback();
+		}
+
+		// applies to connections negotiated after the call
+		void set_compression_policy(const compression_policy& policy) { compression = policy; }
+
+		// windows of all connections follow the new policy with their next window updates
+		void set_flow_control_policy(const flow_control_policy& policy) { flow_control = policy; }
+
+		// limits work taken on by the server, calls beyond them are answered with status_codes::overloaded
+		void set_admission_policy(const admission_policy& policy) { admission.set_policy(policy); }
+		// calls of the function or method executed at once, 0 removes the limit
+		void set_concurrency_limit(std::string_view name, std::size_t limit)
+		{
+			set_concurrency_limit(std::hash<std::string_view>{}(name), limit);
+		}
+		void set_concurrency_limit(id_t id, std::size_t limit) { admission.set_limit(id, limit); }
+		// calls of higher priority classes waiting for a slot are admitted ahead of lower ones,
+		// a sharded server sheds lower ones first instead
+		void set_priority(std::string_view name, priority_t priority)
+		{
+			set_priority(std::hash<std::string_view>{}(name), priority);
+		}
+		void set_priority(id_t id, priority_t priority) { admission.set_priority(id, priority); }
+		admission_counters admission_statistics() { return admission.counters(); }
+
+		// threads serving connections (or reactors of a sharded server) poll for up to spin before
+		// blocking; cpu of the policy is not used, reactors are pinned by shard_policy and
+		// a thread per connection is not worth pinning; set before run
+		void set_busy_poll_policy(const busy_poll_policy& policy) { busy_poll = policy; }
+
+		// idle and half-open connections are closed, quiet ones pinged; set before run
+		void set_keepalive_policy(const keepalive_policy& policy) { keepalive = policy; }
+
+		features_t supported_features() const
+		{
+			return compression.enabled ? features::compression : features::none;
+		}
+
+		bool call_stream(channel& link, features_t negotiated, call_id_t call_id, id_t func_id, const cancellation_token& token)
+		{
+			stream_reader input(link, call_id);
+			stream_writer output(link, call_id,
+				(negotiated & features::compression) ? compression.threshold : std::numeric_limits<std::size_t>::max(),
+				token.deadline());
+
+			auto it = stream_functions.find(func_id);
+			if (it != stream_functions.end())
+				it->second(input, output);
+			// the handler may leave a part of the arguments unread
+			if (!input.drain())
+				return false;
+			if (it == stream_functions.end())
+				return output.close(status_codes::bad);
+			// a writer that gave up waiting for credit of a cancelled call leaves the connection usable
+			const bool cancelled = token.is_cancelled();
+			return output.close(cancelled ? status_codes::cancelled : status_codes::good) || cancelled;
+		}
+
+		// responses of idempotent functions are cached (if enabled) by their raw argument bytes
+		void enable_response_cache(const cache_policy& policy = {})
+		{
+			std::lock_guard lock(response_cache_mutex);
+			response_cache = decltype(response_cache)(policy);
+			response_cache_enabled = true;
+		}
+		cache_counters response_cache_statistics()
+		{
+			std::lock_guard lock(response_cache_mutex);
+			return response_cache.counters();
+		}
+		// number of calls that waited for an identical call in flight instead of executing
+		std::uint64_t coalesced_calls() { return in_flight.coalesced(); }
+
+		// calls, errors, bytes and latencies per function, method and type, merged over all threads;
+		// clients get a summary through builtin_functions::metrics
+		metrics_snapshot metrics_statistics() { return metrics.snapshot(); }
+
+		// fraction of calls traced through their stages, calls traced by their client are always traced;
+		// may be changed while the server runs
+		void set_trace_sample_rate(double rate) { tracing.set_sample_rate(rate); }
+		// spans of the latest traced calls, tracer::write_chrome_json dumps them
+		tracer& traces() { return tracing; }
+
+		// records the frames of connections accepted from now on to path until stop_capture,
+		// rpc_replay feeds them back into a server; every capture has a writer of its own,
+		// connections still holding the previous one find it stopped
+		bool start_capture(const std::string& path, const capture_policy& policy = {})
+		{
+			std::shared_ptr<capture_writer> writer = std::make_shared<capture_writer>();
+			if (!writer->start(path, policy))
+				return false;
+			std::lock_guard lock(capture_mutex);
+			if (capture)
+				capture->stop();
+			capture = std::move(writer);
+			next_captured_connection = 0;
+			return true;
+		}
+		void stop_capture()
+		{
+			std::lock_guard lock(capture_mutex);
+			if (capture)
+				capture->stop();
+		}
+		capture_counters capture_statistics()
+		{
+			std::lock_guard lock(capture_mutex);
+			return capture ? capture->counters() : capture_counters{};
 		}
 
 		misc::buffer<> call_function(id_t func_id, misc::buffer<>& args)
 		{
-			assert(functions.find(func_id) != functions.end());
-			return functions[func_id](args);
+			auto it = functions.find(func_id);
+			assert(it != functions.end());
+			this_trace::mark(trace_stages::lookup);
+			return it->second.invoke(args);
+		}
+		// index must be one the schema gave out
+		misc::buffer<> call_function_at(index_t index, misc::buffer<>& args)
+		{
+			registered_function& function = *function_slots[index].second;
+			this_trace::mark(trace_stages::lookup);
+			return function.invoke(args);
+		}
+
+		frame_flags_t reply_flags_of(id_t func_id) const
+		{
+			if (functions.at(func_id).flags & function_flags::pure)
+				return frame_flags::cacheable;
+			return frame_flags::none;
+		}
+
+		// pure functions are idempotent as well
+		bool is_idempotent(id_t func_id) const
+		{
+			auto it = functions.find(func_id);
+			return it != functions.end() && (it->second.flags & (function_flags::pure | function_flags::idempotent));
+		}
+
+		// executes the function once for all identical calls arriving while it runs,
+		// the sealed reply frame is then shared by all of them and by the cache
+		using shared_response = std::shared_ptr<const misc::buffer<>>;
+
+		shared_response call_function_coalesced(id_t func_id, misc::buffer<>& args)
+		{
+			const call_key_view key{ func_id, std::string_view(reinterpret_cast<const char*>(args.data()), args.size()) };
+			if (shared_response cached = find_response(key))
+				return cached;
+
+			return in_flight.run(call_key{ func_id, std::string(key.arguments) }, [this, func_id, &args, &key]() {
+				// the call might have landed between the cache lookup and the takeoff
+				if (shared_response cached = find_response(key))
+					return cached;
+
+				misc::buffer<> frame = call_function(func_id, args);
+				seal_frame(frame, null_call_id, reply_flags_of(func_id));
+				shared_response response = std::make_shared<const misc::buffer<>>(std::move(frame));
+
+				std::lock_guard lock(response_cache_mutex);
+				if (response_cache_enabled)
+					response_cache.put(call_key{ func_id, std::string(key.arguments) }, response, key.arguments.size() + response->size());
+				return response;
+			});
+		}
+
+		shared_response find_response(const call_key_view& key)
+		{
+			std::lock_guard lock(response_cache_mutex);
+			if (!response_cache_enabled)
+				return nullptr;
+			const shared_response* cached = response_cache.find(key);
+			return cached ? *cached : nullptr;
+		}
+
+		// reply without a result
+		bool send_status(channel& link, call_id_t call_id, status_t status)
+		{
+			misc::buffer<> frame = make_frame(sizeof(status_t));
+			frame.add(status);
+			seal_frame(frame, call_id);
+			return link.send(frame.data(), frame.size());
+		}
+
+		bool send_frame(channel& link, features_t negotiated, const misc::buffer<>& frame)
+		{
+			misc::buffer<> compressed;
+			if ((negotiated & features::compression) && compress_frame(frame, compression.threshold, compressed))
+				return link.send(compressed.data(), compressed.size());
+			return link.send(frame.data(), frame.size());
+		}
+
+		// sends a sealed frame under another call id without copying its payload
+		bool send_shared(channel& link, features_t negotiated, call_id_t call_id, const misc::buffer<>& frame)
+		{
+			misc::buffer<> compressed;
+			if ((negotiated & features::compression) && compress_frame(frame, compression.threshold, compressed)) {
+				header_of(compressed).call_id = call_id;
+				return link.send(compressed.data(), compressed.size());
+			}
+
+			frame_header header = *reinterpret_cast<const frame_header*>(frame.data());
+			header.call_id = call_id;
+			const net::io_slice slices[] = {
+				{ &header, sizeof(frame_header) },
+				{ frame.data() + sizeof(frame_header), frame.size() - sizeof(frame_header) }
+			};
+			return link.send_gather(slices, 2);
 		}
 
 		void create_object(id_t type_id, id_t name_id, misc::buffer<>& args)
 		{
 			assert(types.find(type_id) != types.end());
-			objects.emplace(name_id, types[type_id](args));
+			void* object = types[type_id](args);
+			std::unique_lock lock(objects_mutex);
+			objects.emplace(name_id, object);
 		}
 
 		misc::buffer<> call_method(id_t method_id, id_t object_id, misc::buffer<>& args)
 		{
-			return methods[method_id](objects[object_id], args);
+			void* object = nullptr;
+			{
+				std::shared_lock lock(objects_mutex);
+				auto it = objects.find(object_id);
+				if (it != objects.end())
+					object = it->second;
+			}
+			auto& method = methods[method_id];
+			this_trace::mark(trace_stages::lookup);
+			return method(object, args);
+		}
+		misc::buffer<> call_method_at(index_t index, id_t object_id, misc::buffer<>& args)
+		{
+			void* object = nullptr;
+			{
+				std::shared_lock lock(objects_mutex);
+				auto it = objects.find(object_id);
+				if (it != objects.end())
+					object = it->second;
+			}
+			registered_method& method = *method_slots[index].second;
+			this_trace::mark(trace_stages::lookup);
+			return method(object, args);
 		}
 
-		bool is_stopped = false;
+		// id of the function, method or type a call is for, null_id for negotiation and unknown indices
+		id_t target_of(opcode_t opcode, const std::uint8_t* data) const
+		{
+			switch (opcode) {
+			case opcodes::negotiate:
+				return null_id;
+			case opcodes::call_function_indexed: {
+				const index_t index = misc::get<index_t>(data, 0);
+				return (index < function_slots.size()) ? function_slots[index].first : null_id;
+			}
+			case opcodes::call_method_indexed: {
+				const index_t index = misc::get<index_t>(data, 0);
+				return (index < method_slots.size()) ? method_slots[index].first : null_id;
+			}
+			default:
+				// the id of the function, method or type follows the opcode of the other calls
+				return misc::get<id_t>(data, 0);
+			}
+		}
+
+		// functions and methods past the last index are left out of the table, they are still called by id
+		void add_to_schema(id_t id, schema_kind_t kind, std::size_t index, signature_t arguments, signature_t result)
+		{
+			if (kind != schema_kinds::type && kind != schema_kinds::stream && index >= null_index)
+				return;
+			schema.push_back(schema_entry{ id, static_cast<index_t>(index), kind, arguments, result });
+		}
+
+		struct registered_function
+		{
+			std::function<misc::buffer<>(misc::buffer<>&)> invoke;
+			function_flags_t flags = function_flags::none;
+		};
+		using registered_method = std::function<misc::buffer<>(void*, misc::buffer<>&)>;
+
+		std::atomic<bool> is_stopped = false;
+		// connections served by run, shut down by stop; the mutex guards the listening socket as well
+		std::mutex connections_mutex;
+		std::vector<std::unique_ptr<served_connection>> connections;
+		bool listener_open = false;
+		// clients are served concurrently, objects may be created while others are called
+		std::shared_mutex objects_mutex;
 		std::map<id_t, void*> objects;
 		std::map<id_t, std::function<void* (misc::buffer<>&)>> types;
-		std::map<id_t, std::function<misc::buffer<>(misc::buffer<>&)>> functions;
-		std::map<id_t, std::function<misc::buffer<>(void*, misc::buffer<>&)>> methods;
+		std::map<id_t, registered_function> functions;
+		std::map<id_t, registered_method> methods;
+		std::map<id_t, stream_function> stream_functions;
+		// dense tables indexed calls are dispatched through, nodes of the maps never move
+		std::vector<std::pair<id_t, registered_function*>> function_slots;
+		std::vector<std::pair<id_t, registered_method*>> method_slots;
+		std::vector<schema_entry> schema;
+
+		compression_policy compression = {};
+		std::atomic<flow_control_policy> flow_control = flow_control_policy{};
+		admission_controller admission;
+		metrics_registry metrics;
+		tracer tracing{ "rpc server" };
+		// kept after stop_capture for its counters
+		std::mutex capture_mutex;
+		std::shared_ptr<capture_writer> capture;
+		std::uint32_t next_captured_connection = 0;
+
+		net::address<net::IPv::IPv4> listen_address;
+		std::vector<std::unique_ptr<shard>> shards;
+		bool sharded = false;
+		bool shared_port = true;
+		static constexpr std::size_t max_burst = 64;
+		busy_poll_policy busy_poll = {};
+		keepalive_policy keepalive = {};
+
+		std::mutex response_cache_mutex;
+		bool response_cache_enabled = false;
+		lru_cache<call_key, shared_response, call_key_hash, call_key_equal> response_cache;
+		single_flight<call_key, shared_response, call_key_hash, call_key_equal> in_flight;
 	};
 }
\ No newline at end of file
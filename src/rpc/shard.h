@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <utility>
+
+#include "../networking/networking.h"
+#include "mpsc_queue.h"
+
+#if PLATFORM == PLATFORM_UNIX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace rpc
+{
+
+	// sharded server runs one reactor per core, each with its own listening socket and connections
+	struct shard_policy
+	{
+		// 0 means one shard per hardware thread
+		std::size_t shards = 0;
+		// reactor of shard i runs on cpu first_cpu + i; memory it allocates afterwards comes
+		// from the local NUMA node under the default first-touch policy
+		bool pin_threads = true;
+		std::size_t first_cpu = 0;
+		// resolution of the timers of a reactor, such as the keepalive of its connections
+		std::chrono::microseconds timer_tick = std::chrono::milliseconds(1);
+	};
+
+	// index of the shard whose reactor runs the current thread, for handlers of a sharded server
+	namespace this_shard
+	{
+		namespace detail
+		{
+			inline thread_local std::size_t index = std::numeric_limits<std::size_t>::max();
+		}
+
+		// max of size_t outside of reactors
+		inline std::size_t index() { return detail::index; }
+	}
+
+	// false where the platform doesn't support it (mac os) or the cpu doesn't exist
+	inline bool pin_current_thread(std::size_t cpu)
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		if (cpu >= sizeof(DWORD_PTR) * 8)
+			return false;
+		return ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif PLATFORM == PLATFORM_UNIX
+		if (cpu >= CPU_SETSIZE)
+			return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// tasks posted from any thread to the thread owning the mailbox, which waits for them
+	// together with its sockets; this is the only way shards talk to each other.
+	// Posting never locks, and a burst of tasks costs the owner a single wakeup. Nodes are recycled,
+	// so once warmed up a post allocates only if the task's captures outgrow std::function's inline storage
+	class mailbox
+	{
+	public:
+		using task = std::function<void()>;
+
+	private:
+		struct task_node : mpsc_node
+		{
+			task work;
+			task_node* next_free = nullptr;
+		};
+
+		// nodes run by any mailbox go back here instead of being freed; a posting thread takes the whole
+		// stack at once when its own cache is empty, as the stack is only ever pushed to or emptied it has no ABA
+		struct node_stack
+		{
+			std::atomic<task_node*> head;
+			node_stack() : head(nullptr) {}
+			~node_stack() { free_nodes(head.exchange(nullptr)); }
+		};
+		struct node_cache
+		{
+			task_node* head;
+			node_cache() : head(nullptr) {}
+			~node_cache() { free_nodes(head); }
+		};
+		static inline node_stack s_free;
+		static inline thread_local node_cache t_cache;
+
+		mpsc_queue m_tasks;
+		// set by the first post after the owner went through the tasks, the rest don't signal again
+		alignas(cache_line_size) std::atomic<bool> m_signalled = false;
+#if PLATFORM == PLATFORM_UNIX
+		// eventfd, readable while its counter is not zero
+		socket_t m_event = -1;
+#else
+		// [0] is waited on by the owner, a byte written to [1] wakes it up
+		socket_t m_wakeup[2] = {};
+#endif
+		bool m_open = false;
+
+	public:
+		mailbox()
+		{
+#if PLATFORM == PLATFORM_UNIX
+			m_event = ::eventfd(0, EFD_NONBLOCK);
+			m_open = m_event >= 0;
+#else
+			m_open = net::socket_pair(m_wakeup);
+#endif
+		}
+		~mailbox()
+		{
+			while (mpsc_node* node = m_tasks.pop())
+				delete static_cast<task_node*>(node);
+			if (!m_open)
+				return;
+#if PLATFORM == PLATFORM_UNIX
+			net::close_socket(m_event);
+#else
+			net::close_socket(m_wakeup[0]);
+			net::close_socket(m_wakeup[1]);
+#endif
+		}
+		mailbox(const mailbox&) = delete;
+		mailbox& operator=(const mailbox&) = delete;
+
+		bool is_open() const { return m_open; }
+		// becomes readable once a task is posted
+		socket_t handle() const
+		{
+#if PLATFORM == PLATFORM_UNIX
+			return m_event;
+#else
+			return m_wakeup[0];
+#endif
+		}
+
+		void post(task work)
+		{
+			task_node* node = acquire_node();
+			node->work = std::move(work);
+			m_tasks.push(node);
+			if (m_signalled.exchange(true, std::memory_order_acq_rel))
+				return;
+#if PLATFORM == PLATFORM_UNIX
+			const std::uint64_t increment = 1;
+			[[maybe_unused]] const ssize_t written = ::write(m_event, &increment, sizeof(increment));
+#else
+			const char signal = 0;
+			::send(m_wakeup[1], &signal, 1, 0);
+#endif
+		}
+
+		// runs everything posted so far, called by the owner when handle() is readable
+		void run()
+		{
+#if PLATFORM == PLATFORM_UNIX
+			std::uint64_t counter;
+			[[maybe_unused]] const ssize_t read_bytes = ::read(m_event, &counter, sizeof(counter));
+#else
+			char signal;
+			::recv(m_wakeup[0], &signal, 1, 0);
+#endif
+			// cleared before popping, so a task pushed after the last pop signals again
+			m_signalled.store(false, std::memory_order_release);
+			while (mpsc_node* node = m_tasks.pop()) {
+				task_node* next = static_cast<task_node*>(node);
+				next->work();
+				recycle_node(next);
+			}
+		}
+
+	private:
+		static task_node* acquire_node()
+		{
+			if (!t_cache.head)
+				t_cache.head = s_free.head.exchange(nullptr, std::memory_order_acquire);
+			task_node* node = t_cache.head;
+			if (!node)
+				return new task_node;
+			t_cache.head = node->next_free;
+			return node;
+		}
+
+		static void recycle_node(task_node* node)
+		{
+			// captures of the task are released now, not when the node is reused
+			node->work = nullptr;
+			node->next_free = s_free.head.load(std::memory_order_relaxed);
+			while (!s_free.head.compare_exchange_weak(node->next_free, node, std::memory_order_release, std::memory_order_relaxed)) {}
+		}
+
+		static void free_nodes(task_node* node)
+		{
+			while (node) {
+				task_node* next = node->next_free;
+				delete node;
+				node = next;
+			}
+		}
+	};
+
+}
\ No newline at end of file
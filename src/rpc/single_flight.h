@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace rpc
+{
+
+	// coalesces concurrent executions with equal keys: the first caller runs the function,
+	// callers arriving while it is in flight wait for and share its result
+	template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<>>
+	class single_flight
+	{
+	private:
+		struct flight
+		{
+			std::condition_variable landed;
+			bool finished = false;
+			Value value = {};
+		};
+
+		std::mutex m_mutex;
+		std::unordered_map<Key, std::shared_ptr<flight>, Hash, Equal> m_flights;
+		std::uint64_t m_executions = 0;
+		std::uint64_t m_coalesced = 0;
+
+	public:
+		template<typename Function>
+		Value run(Key key, Function&& function)
+		{
+			std::unique_lock lock(m_mutex);
+			auto it = m_flights.find(key);
+			if (it != m_flights.end()) {
+				std::shared_ptr<flight> current = it->second;
+				++m_coalesced;
+				current->landed.wait(lock, [&current]() { return current->finished; });
+				return current->value;
+			}
+
+			std::shared_ptr<flight> current = std::make_shared<flight>();
+			// references to elements survive rehashing, iterators don't
+			const Key& flight_key = m_flights.emplace(std::move(key), current).first->first;
+			++m_executions;
+			lock.unlock();
+
+			Value value = function();
+
+			lock.lock();
+			current->value = value;
+			current->finished = true;
+			m_flights.erase(m_flights.find(flight_key));
+			lock.unlock();
+			current->landed.notify_all();
+			return value;
+		}
+
+		std::uint64_t executions()
+		{
+			std::lock_guard lock(m_mutex);
+			return m_executions;
+		}
+		std::uint64_t coalesced()
+		{
+			std::lock_guard lock(m_mutex);
+			return m_coalesced;
+		}
+	};
+
+}
\ No newline at end of file
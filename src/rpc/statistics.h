@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+namespace rpc
+{
+
+	// log-linear histogram of durations in nanoseconds (HDR-like):
+	// every power of two is split into 8 linear sub-buckets,
+	// so reported percentiles are within 12.5% of the real value
+	class latency_histogram
+	{
+	public:
+		static constexpr std::size_t sub_bucket_bits = 3;
+		static constexpr std::size_t sub_buckets = 1 << sub_bucket_bits;
+		static constexpr std::size_t buckets = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+	private:
+		std::array<std::uint64_t, buckets> m_counts = {};
+		std::uint64_t m_total = 0;
+		std::uint64_t m_max = 0;
+
+	public:
+		static constexpr std::size_t index_of(std::uint64_t value)
+		{
+			if (value < sub_buckets)
+				return static_cast<std::size_t>(value);
+			const std::size_t shift = std::bit_width(value) - 1 - sub_bucket_bits;
+			return (shift + 1) * sub_buckets + static_cast<std::size_t>((value >> shift) & (sub_buckets - 1));
+		}
+		// middle of the range covered by the bucket
+		static constexpr std::uint64_t value_of(std::size_t index)
+		{
+			if (index < sub_buckets)
+				return index;
+			const std::size_t shift = index / sub_buckets - 1;
+			const std::uint64_t lower = (sub_buckets + index % sub_buckets) << shift;
+			return lower + ((std::uint64_t(1) << shift) >> 1);
+		}
+
+		void record(std::uint64_t value, std::uint64_t count = 1)
+		{
+			m_counts[index_of(value)] += count;
+			m_total += count;
+			if (value > m_max)
+				m_max = value;
+		}
+		void record(std::chrono::nanoseconds duration)
+		{
+			record(static_cast<std::uint64_t>(duration.count() > 0 ? duration.count() : 0));
+		}
+
+		// p is in [0, 1], returns 0 for an empty histogram
+		std::uint64_t percentile(double p) const
+		{
+			if (m_total == 0)
+				return 0;
+			std::uint64_t rank = static_cast<std::uint64_t>(p * m_total);
+			if (rank >= m_total)
+				rank = m_total - 1;
+
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < buckets; ++i) {
+				seen += m_counts[i];
+				if (seen > rank)
+					return (value_of(i) < m_max) ? value_of(i) : m_max;
+			}
+			return m_max;
+		}
+
+		void merge(const latency_histogram& other)
+		{
+			for (std::size_t i = 0; i < buckets; ++i)
+				m_counts[i] += other.m_counts[i];
+			m_total += other.m_total;
+			if (other.m_max > m_max)
+				m_max = other.m_max;
+		}
+
+		// halves every bucket so that older samples weigh less than new ones
+		void decay()
+		{
+			m_total = 0;
+			for (std::uint64_t& count : m_counts) {
+				count >>= 1;
+				m_total += count;
+			}
+		}
+
+		void reset()
+		{
+			m_counts = {};
+			m_total = 0;
+			m_max = 0;
+		}
+
+		std::uint64_t count() const { return m_total; }
+		std::uint64_t max() const { return m_max; }
+	};
+
+}
\ No newline at end of file
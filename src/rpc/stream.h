@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <type_traits>
+
+#include "miscellaneous.h"
+#include "frame.h"
+#include "channel.h"
+
+namespace rpc
+{
+
+	const std::size_t stream_chunk_size = 64 * net::kilobyte;
+
+	// reads chunk frames of one streamed call as they arrive,
+	// at most one chunk is held in memory at a time and credit is granted back as chunks are consumed
+	class stream_reader
+	{
+	private:
+		channel* m_channel = nullptr;
+		call_id_t m_call_id = null_call_id;
+		window m_window;
+		misc::buffer<> m_chunk;
+		std::size_t m_offset = 0;
+		bool m_finished = false;
+		bool m_failed = false;
+		status_t m_status = status_codes::good;
+
+	public:
+		stream_reader() : m_finished(true), m_failed(true) {}
+		stream_reader(channel& link, call_id_t call_id)
+			: m_channel(&link), m_call_id(call_id) {}
+
+		// returns the unread part of the current chunk, fetching the next one when needed;
+		// an empty span means the end of the stream
+		std::span<const std::uint8_t> next()
+		{
+			while (m_offset == m_chunk.size()) {
+				if (m_finished || !fetch())
+					return {};
+			}
+			std::span<const std::uint8_t> rest(m_chunk.data() + m_offset, m_chunk.size() - m_offset);
+			m_offset = m_chunk.size();
+			return rest;
+		}
+
+		// copies up to size bytes, returns how many were copied (less only at the end of the stream)
+		std::size_t read(void* data, std::size_t size)
+		{
+			std::size_t copied = 0;
+			while (copied < size) {
+				if (m_offset == m_chunk.size() && (m_finished || !fetch()))
+					break;
+				const std::size_t part = std::min(size - copied, m_chunk.size() - m_offset);
+				std::memcpy(static_cast<std::uint8_t*>(data) + copied, m_chunk.data() + m_offset, part);
+				m_offset += part;
+				copied += part;
+			}
+			return copied;
+		}
+		template<typename T>
+		bool read(T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be read from a stream");
+			return read(&value, sizeof(T)) == sizeof(T);
+		}
+
+		// skips whatever is left of the stream, so the connection can carry the next call
+		bool drain()
+		{
+			while (!m_finished)
+				fetch();
+			return !m_failed;
+		}
+
+		bool is_finished() const { return m_finished; }
+		bool is_failed() const { return m_failed; }
+		// sent by the server with the end of the result stream
+		status_t status() const { return m_status; }
+
+	private:
+		bool fetch()
+		{
+			if (!release())
+				return fail();
+
+			m_offset = 0;
+			// frames of other calls, like pipelined calls or replies, stay queued for their receivers
+			frame_header header;
+			if (!m_channel->receive_for(m_call_id, header, m_chunk))
+				return fail();
+
+			if (header.flags & frame_flags::stream_end) {
+				if (!m_chunk.is_empty())
+					m_status = misc::get<status_t>(m_chunk.data(), 0);
+				m_chunk.clear();
+				m_channel->take_advanced(m_call_id);
+				m_finished = true;
+				return false;
+			}
+			m_window.available -= m_chunk.size();
+			m_window.unconsumed += m_chunk.size();
+			return true;
+		}
+
+		// the current chunk is consumed, its credit goes back to the sender
+		bool release()
+		{
+			const std::size_t consumed = m_chunk.size();
+			m_chunk.clear();
+			m_window.unconsumed -= consumed;
+			m_window.available += m_channel->take_advanced(m_call_id);
+			if (consumed > 0 && !m_channel->consume(consumed))
+				return false;
+			return m_channel->send_window_update(m_call_id, m_window.grant(m_channel->policy().stream_window));
+		}
+
+		bool fail()
+		{
+			m_chunk.clear();
+			m_finished = m_failed = true;
+			return false;
+		}
+	};
+
+	// cuts written bytes into chunk frames of one streamed call, memory used is one chunk
+	// regardless of how much is written; sending waits while the receiver grants no credit,
+	// but not past the deadline
+	class stream_writer
+	{
+	private:
+		channel* m_channel = nullptr;
+		call_id_t m_call_id = null_call_id;
+		std::size_t m_compression_threshold = std::numeric_limits<std::size_t>::max();
+		channel::clock::time_point m_deadline = channel::clock::time_point::max();
+		misc::buffer<> m_chunk;
+		bool m_closed = false;
+		bool m_failed = false;
+
+	public:
+		stream_writer() : m_closed(true), m_failed(true) {}
+		// chunks of at least compression_threshold bytes are compressed (if it pays off)
+		stream_writer(channel& link, call_id_t call_id,
+			std::size_t compression_threshold = std::numeric_limits<std::size_t>::max(),
+			channel::clock::time_point deadline = channel::clock::time_point::max())
+			: m_channel(&link), m_call_id(call_id), m_compression_threshold(compression_threshold), m_deadline(deadline),
+			m_chunk(make_frame(stream_chunk_size))
+		{
+			m_channel->open_stream(m_call_id);
+		}
+
+		bool write(const void* data, std::size_t size)
+		{
+			if (m_closed)
+				return false;
+			const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+			while (size > 0 && !m_failed) {
+				const std::size_t part = std::min(size, m_chunk.capacity() - m_chunk.size());
+				m_chunk.add(bytes, part);
+				bytes += part;
+				size -= part;
+				if (m_chunk.size() == m_chunk.capacity())
+					send(frame_flags::stream_chunk);
+			}
+			return !m_failed;
+		}
+		template<typename T>
+		bool write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be written to a stream");
+			return write(&value, sizeof(T));
+		}
+
+		// sends the values as a separate chunk, so the reader gets them in one piece
+		template<typename ...Values>
+		bool write_item(const Values&... values)
+		{
+			if (!flush() || m_closed)
+				return false;
+			if (!m_chunk.reserve(sizeof(frame_header) + misc::encoded_size(values...)))
+				return false;
+			m_chunk.add(values...);
+			send(frame_flags::stream_chunk);
+			return !m_failed;
+		}
+
+		// sends buffered bytes right away even if the chunk is not full
+		bool flush()
+		{
+			if (m_closed)
+				return !m_failed;
+			if (m_chunk.size() > sizeof(frame_header))
+				send(frame_flags::stream_chunk);
+			return !m_failed;
+		}
+
+		// flushes and marks the end of the stream, trailer values travel with the end frame
+		template<typename ...Trailer>
+		bool close(const Trailer&... trailer)
+		{
+			if (m_closed)
+				return !m_failed;
+			flush();
+			m_chunk.add(trailer...);
+			send(frame_flags::stream_end);
+			m_channel->close_stream(m_call_id);
+			m_closed = true;
+			return !m_failed;
+		}
+
+		bool is_failed() const { return m_failed; }
+
+	private:
+		void send(frame_flags_t flags)
+		{
+			seal_frame(m_chunk, m_call_id, flags);
+			misc::buffer<> compressed;
+			const misc::buffer<>& frame = compress_frame(m_chunk, m_compression_threshold, compressed) ? compressed : m_chunk;
+			const bool sent = (flags & frame_flags::stream_chunk)
+				? m_channel->send_data(m_call_id, frame.data(), frame.size(), m_chunk.size() - sizeof(frame_header), m_deadline)
+				: m_channel->send(frame.data(), frame.size());
+			if (!sent)
+				m_failed = true;
+			m_chunk.set_size(sizeof(frame_header));
+		}
+	};
+
+	// decodes one item written by stream_writer::write_item
+	template<typename T>
+	T decode_item(std::span<const std::uint8_t> bytes)
+	{
+		if constexpr (misc::is_container<T>::value) {
+			using value_type = typename T::value_type;
+			std::size_t size = 0;
+			assert(bytes.size() >= sizeof(size));
+			std::memcpy(&size, bytes.data(), sizeof(size));
+			assert(bytes.size() >= sizeof(size) + size);
+			const value_type* data = reinterpret_cast<const value_type*>(bytes.data() + sizeof(size));
+			return T(data, data + size / sizeof(value_type));
+		}
+		else {
+			assert(bytes.size() >= sizeof(T));
+			T value;
+			std::memcpy(&value, bytes.data(), sizeof(T));
+			return value;
+		}
+	}
+
+	// typed result stream for stream functions producing a sequence, each value is its own frame
+	template<typename T>
+	class sink
+	{
+	private:
+		stream_writer& m_output;
+
+	public:
+		explicit sink(stream_writer& output) : m_output(output) {}
+
+		bool push(const T& value) { return m_output.write_item(value); }
+	};
+
+	// client side of a result sequence, items are decoded one by one as their frames arrive
+	template<typename T>
+	class sequence
+	{
+	private:
+		stream_reader m_reader;
+
+	public:
+		class iterator
+		{
+		private:
+			sequence* m_owner = nullptr;
+			T m_value = {};
+			bool m_done = true;
+
+			void advance()
+			{
+				const std::span<const std::uint8_t> item = m_owner->m_reader.next();
+				m_done = item.empty();
+				if (!m_done)
+					m_value = decode_item<T>(item);
+			}
+
+		public:
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+
+			iterator() = default;
+			explicit iterator(sequence* owner) : m_owner(owner), m_done(false) { advance(); }
+
+			const T& operator*() const { return m_value; }
+			iterator& operator++()
+			{
+				advance();
+				return *this;
+			}
+			void operator++(int) { advance(); }
+			bool operator==(std::default_sentinel_t) const { return m_done; }
+		};
+
+		explicit sequence(stream_reader&& reader) : m_reader(std::move(reader)) {}
+
+		iterator begin() { return iterator(this); }
+		std::default_sentinel_t end() const { return {}; }
+
+		// meaningful once the sequence has been read to its end
+		status_t status() const { return m_reader.status(); }
+		bool is_failed() const { return m_reader.is_failed(); }
+	};
+
+	// both directions of a streamed call made by the client: arguments are written to input,
+	// which must be closed before the result is read from output
+	struct stream_call
+	{
+		stream_writer input;
+		stream_reader output;
+	};
+
+	using stream_function = std::function<void(stream_reader&, stream_writer&)>;
+
+}
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace rpc
+{
+
+	// hierarchical timing wheel: 4 levels of 256 slots cover 2^32 ticks,
+	// scheduling and cancelling are O(1) and advancing costs O(1) per tick plus the expired timers;
+	// timers are intrusive, so a wheel of hundreds of thousands of them allocates nothing
+	class timing_wheel
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+		static constexpr std::size_t slot_bits = 8;
+		static constexpr std::size_t slots = std::size_t(1) << slot_bits;
+		static constexpr std::size_t levels = 4;
+		static constexpr std::uint64_t max_ticks = (std::uint64_t(1) << (slot_bits * levels)) - 1;
+
+		class timer
+		{
+		private:
+			friend class timing_wheel;
+
+			timer* m_prev = nullptr;
+			timer* m_next = nullptr;
+			// head of the slot list the timer is in, null if not scheduled
+			timer** m_slot = nullptr;
+			timing_wheel* m_wheel = nullptr;
+			std::uint64_t m_expiry = 0;
+
+		public:
+			std::function<void()> callback;
+
+			timer() {}
+			explicit timer(std::function<void()> function) : callback(std::move(function)) {}
+			~timer() { cancel(); }
+			timer(const timer&) = delete;
+			timer& operator=(const timer&) = delete;
+
+			bool is_scheduled() const { return m_slot != nullptr; }
+			void cancel()
+			{
+				if (is_scheduled())
+					m_wheel->cancel(*this);
+			}
+		};
+
+	private:
+		std::array<std::array<timer*, slots>, levels> m_slots = {};
+		clock::duration m_tick;
+		clock::time_point m_start;
+		std::uint64_t m_now = 0;
+		std::size_t m_size = 0;
+
+	public:
+		explicit timing_wheel(clock::duration tick = std::chrono::milliseconds(1), clock::time_point start = clock::now())
+			: m_tick(tick), m_start(start) {}
+		timing_wheel(const timing_wheel&) = delete;
+		timing_wheel& operator=(const timing_wheel&) = delete;
+		~timing_wheel()
+		{
+			for (auto& level : m_slots) {
+				for (timer*& head : level) {
+					while (head)
+						unlink(*head);
+				}
+			}
+		}
+
+		// fires the callback once delay passed (rounded up to whole ticks), reschedules if already scheduled;
+		// delays beyond max_ticks are clamped
+		void schedule(timer& entry, clock::duration delay)
+		{
+			cancel(entry);
+			std::uint64_t ticks = (delay.count() <= 0) ? 1 : static_cast<std::uint64_t>((delay + m_tick - clock::duration(1)) / m_tick);
+			if (ticks > max_ticks)
+				ticks = max_ticks;
+			entry.m_expiry = m_now + ticks;
+			entry.m_wheel = this;
+			place(entry);
+			++m_size;
+		}
+
+		void cancel(timer& entry)
+		{
+			if (!entry.is_scheduled())
+				return;
+			unlink(entry);
+			--m_size;
+		}
+
+		// fires every timer that expired by now, callbacks may schedule and cancel timers;
+		// returns how many fired
+		std::size_t advance(clock::time_point now = clock::now())
+		{
+			if (now < m_start)
+				return 0;
+			const std::uint64_t target = static_cast<std::uint64_t>((now - m_start) / m_tick);
+			std::size_t fired = 0;
+			while (m_now < target) {
+				// nothing to cascade or fire, jump straight to now
+				if (m_size == 0) {
+					m_now = target;
+					break;
+				}
+				++m_now;
+				for (std::size_t level = levels - 1; level > 0; --level) {
+					if ((m_now & ((std::uint64_t(1) << (level * slot_bits)) - 1)) != 0)
+						continue;
+					timer*& head = m_slots[level][(m_now >> (level * slot_bits)) & (slots - 1)];
+					while (head) {
+						timer& entry = *head;
+						unlink(entry);
+						place(entry);
+					}
+				}
+				timer*& head = m_slots[0][m_now & (slots - 1)];
+				while (head) {
+					timer& entry = *head;
+					unlink(entry);
+					--m_size;
+					++fired;
+					if (entry.callback)
+						entry.callback();
+				}
+			}
+			return fired;
+		}
+
+		// time until the next tick that may fire a timer, negative if no timer is scheduled;
+		// meant as the timeout of the event loop's wait
+		clock::duration until_next(clock::time_point now = clock::now()) const
+		{
+			if (m_size == 0)
+				return clock::duration(-1);
+			std::uint64_t tick = m_now + 1;
+			for (; tick <= m_now + slots; ++tick) {
+				// timers of higher levels cascade down at the boundary
+				if ((tick & (slots - 1)) == 0 || m_slots[0][tick & (slots - 1)])
+					break;
+			}
+			const clock::time_point due = m_start + m_tick * static_cast<clock::rep>(tick);
+			return (due > now) ? due - now : clock::duration(0);
+		}
+
+		std::size_t size() const { return m_size; }
+		clock::duration tick() const { return m_tick; }
+
+	private:
+		// the level is picked by the highest group of bits in which expiry and now differ
+		void place(timer& entry)
+		{
+			const std::uint64_t difference = (entry.m_expiry ^ m_now) | (slots - 1);
+			std::size_t level = (std::bit_width(difference) - 1) / slot_bits;
+			if (level >= levels)
+				level = levels - 1;
+			timer*& head = m_slots[level][(entry.m_expiry >> (level * slot_bits)) & (slots - 1)];
+			entry.m_prev = nullptr;
+			entry.m_next = head;
+			if (head)
+				head->m_prev = &entry;
+			head = &entry;
+			entry.m_slot = &head;
+		}
+
+		void unlink(timer& entry)
+		{
+			if (entry.m_prev)
+				entry.m_prev->m_next = entry.m_next;
+			else
+				*entry.m_slot = entry.m_next;
+			if (entry.m_next)
+				entry.m_next->m_prev = entry.m_prev;
+			entry.m_prev = entry.m_next = nullptr;
+			entry.m_slot = nullptr;
+		}
+	};
+
+}
\ No newline at end of file
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "miscellaneous.h"
+#include "../networking/accounting.h"
+
+#if PLATFORM == PLATFORM_WINDOWS
+#include <process.h>
+#endif
+
+namespace rpc
+{
+
+	// carried by the frames of a traced call, 0 means the call isn't traced
+	using trace_id_t = std::uint64_t;
+
+	// stages a traced call goes through, each ends where it is marked and begins where the one before ended
+	using trace_stage_t = std::uint8_t;
+	namespace trace_stages
+	{
+		// server: from the frame arriving until the server takes it up
+		const trace_stage_t receive = 0;
+		// server: header and opcode
+		const trace_stage_t decode = 1;
+		// server: finding the registered function or method
+		const trace_stage_t lookup = 2;
+		const trace_stage_t unpack = 3;
+		const trace_stage_t execute = 4;
+		// server: packing and sealing the result; client: packing the arguments
+		const trace_stage_t encode = 5;
+		const trace_stage_t send = 6;
+		// client: from the call being sent until its reply arrived
+		const trace_stage_t wait = 7;
+		const std::size_t count = 8;
+
+		inline const char* name(trace_stage_t stage)
+		{
+			static const char* const names[count] = { "receive", "decode", "lookup", "unpack", "execute", "encode", "send", "wait" };
+			return (stage < count) ? names[stage] : "unknown";
+		}
+	}
+
+	class tracer;
+
+#if defined(RPC_ACCOUNTING)
+	// what a call allocated and copied in each of its stages: a stage is charged
+	// with what the thread counted since the stage marked before it
+	class stage_accounting
+	{
+	public:
+		using stages_t = std::array<misc::accounting::counters, trace_stages::count>;
+
+	private:
+		misc::accounting::counters m_last;
+		stages_t m_stages = {};
+
+	public:
+		stage_accounting() : m_last(misc::accounting::thread_counters()) {}
+
+		// counting starts from start instead of from construction
+		void account_from(const misc::accounting::counters& start) { m_last = start; }
+		void mark(trace_stage_t stage)
+		{
+			const misc::accounting::counters now = misc::accounting::thread_counters();
+			m_stages[stage] += now - m_last;
+			m_last = now;
+		}
+		const stages_t& stages() const { return m_stages; }
+	};
+#else
+	// counts nothing without RPC_ACCOUNTING
+	class stage_accounting
+	{
+	public:
+		using stages_t = std::array<misc::accounting::counters, trace_stages::count>;
+
+		void account_from(const misc::accounting::counters&) {}
+		void mark(trace_stage_t) {}
+		const stages_t& stages() const
+		{
+			static const stages_t none = {};
+			return none;
+		}
+	};
+#endif
+
+	// stages of one traced call, recorded with the tracer when it goes out of scope;
+	// a span of a call that isn't traced only does the stage accounting
+	class trace_span
+	{
+	public:
+		using clock = std::chrono::steady_clock;
+
+	private:
+		friend class tracer;
+
+		tracer* m_tracer = nullptr;
+		trace_id_t m_id = 0;
+		call_id_t m_call_id = null_call_id;
+		id_t m_target = null_id;
+		clock::time_point m_begin = {};
+		// zero for stages the call didn't go through
+		std::array<clock::time_point, trace_stages::count> m_ends = {};
+		stage_accounting m_accounting;
+
+	public:
+		trace_span() {}
+		// target is the id of the function, method or type called
+		trace_span(tracer& owner, trace_id_t id, id_t target, clock::time_point begin = clock::now())
+			: m_tracer(id ? &owner : nullptr), m_id(id), m_target(target), m_begin(begin) {}
+		~trace_span();
+		trace_span(const trace_span&) = delete;
+		trace_span& operator=(const trace_span&) = delete;
+
+		bool is_traced() const { return m_tracer != nullptr; }
+		trace_id_t id() const { return m_id; }
+
+		void mark(trace_stage_t stage)
+		{
+			m_accounting.mark(stage);
+			if (m_tracer)
+				m_ends[stage] = clock::now();
+		}
+		stage_accounting& accounting() { return m_accounting; }
+		const stage_accounting& accounting() const { return m_accounting; }
+		void set_call_id(call_id_t call_id) { m_call_id = call_id; }
+		void set_call(call_id_t call_id, id_t target)
+		{
+			m_call_id = call_id;
+			m_target = target;
+		}
+	};
+
+	// span of the call the current thread works on, so code that doesn't see the span can mark stages
+	namespace this_trace
+	{
+		namespace detail
+		{
+			inline thread_local trace_span* current = nullptr;
+		}
+
+		inline void mark(trace_stage_t stage)
+		{
+			if (detail::current)
+				detail::current->mark(stage);
+		}
+		// 0 if the call isn't traced
+		inline trace_id_t id() { return detail::current ? detail::current->id() : 0; }
+		inline void set_call_id(call_id_t call_id)
+		{
+			if (detail::current)
+				detail::current->set_call_id(call_id);
+		}
+	}
+
+	// makes the span current for the thread while it is in scope
+	class trace_scope
+	{
+	private:
+		trace_span* m_previous;
+
+	public:
+		explicit trace_scope(trace_span& span) : m_previous(this_trace::detail::current) { this_trace::detail::current = &span; }
+		~trace_scope() { this_trace::detail::current = m_previous; }
+		trace_scope(const trace_scope&) = delete;
+		trace_scope& operator=(const trace_scope&) = delete;
+	};
+
+	// samples calls for tracing and keeps the spans of the latest ones, which are written
+	// as Chrome trace events (chrome://tracing, ui.perfetto.dev). Calls that aren't sampled cost
+	// a relaxed load; timestamps are taken from steady_clock, so traces of processes on one host line up
+	class tracer
+	{
+	public:
+		using clock = trace_span::clock;
+
+	private:
+		struct record
+		{
+			trace_id_t id;
+			call_id_t call_id;
+			id_t target;
+			std::size_t thread;
+			clock::time_point begin;
+			std::array<clock::time_point, trace_stages::count> ends;
+		};
+
+		// a call is sampled if 32 random bits fall below it, 2^32 traces every call
+		std::atomic<std::uint64_t> m_threshold = 0;
+		std::string m_name;
+
+		std::mutex m_mutex;
+		// ring of the latest spans
+		std::vector<record> m_records;
+		std::size_t m_capacity;
+		std::size_t m_next = 0;
+
+	public:
+		// name labels the process in the trace viewer, capacity is the number of spans kept
+		explicit tracer(std::string_view name = "rpc", std::size_t capacity = 64 * 1024)
+			: m_name(name), m_capacity(std::max<std::size_t>(capacity, 1)) {}
+		tracer(const tracer&) = delete;
+		tracer& operator=(const tracer&) = delete;
+
+		// fraction of calls traced, 0 turns tracing off; may be changed while calls run
+		void set_sample_rate(double rate)
+		{
+			rate = std::clamp(rate, 0.0, 1.0);
+			m_threshold.store(static_cast<std::uint64_t>(rate * 4294967296.0), std::memory_order_relaxed);
+		}
+		double sample_rate() const { return m_threshold.load(std::memory_order_relaxed) / 4294967296.0; }
+
+		// id of a new trace if the call is sampled, 0 otherwise
+		trace_id_t sample()
+		{
+			const std::uint64_t threshold = m_threshold.load(std::memory_order_relaxed);
+			if (threshold == 0)
+				return 0;
+			const std::uint64_t random = next_random();
+			if ((random >> 32) >= threshold)
+				return 0;
+			return random | 1;
+		}
+
+		void record_span(const trace_span& span)
+		{
+			record entry{ span.m_id, span.m_call_id, span.m_target,
+				std::hash<std::thread::id>{}(std::this_thread::get_id()), span.m_begin, span.m_ends };
+			std::lock_guard lock(m_mutex);
+			if (m_records.size() < m_capacity)
+				m_records.push_back(entry);
+			else
+				m_records[m_next] = entry;
+			m_next = (m_next + 1) % m_capacity;
+		}
+
+		void clear()
+		{
+			std::lock_guard lock(m_mutex);
+			m_records.clear();
+			m_next = 0;
+		}
+
+		// trace event format: a complete event for the call and one for each of its stages
+		void write_chrome_json(std::ostream& output)
+		{
+			std::vector<record> records;
+			{
+				std::lock_guard lock(m_mutex);
+				records = m_records;
+			}
+			const unsigned long long pid = process_id();
+			output << "{\"traceEvents\":[\n";
+			output << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << m_name << "\"}}";
+
+			std::array<std::pair<clock::time_point, trace_stage_t>, trace_stages::count> stages;
+			for (const record& entry : records) {
+				std::size_t marked = 0;
+				for (trace_stage_t stage = 0; stage < trace_stages::count; ++stage) {
+					if (entry.ends[stage] != clock::time_point{})
+						stages[marked++] = { entry.ends[stage], stage };
+				}
+				std::sort(stages.begin(), stages.begin() + marked);
+				const clock::time_point end = marked ? stages[marked - 1].first : entry.begin;
+
+				char trace_id[17];
+				std::snprintf(trace_id, sizeof(trace_id), "%016llx", static_cast<unsigned long long>(entry.id));
+				write_event(output, "call", pid, entry.thread, entry.begin, end);
+				output << ",\"args\":{\"trace_id\":\"" << trace_id << "\",\"call_id\":" << entry.call_id
+					<< ",\"id\":" << entry.target << "}}";
+
+				clock::time_point begin = entry.begin;
+				for (std::size_t i = 0; i < marked; ++i) {
+					write_event(output, trace_stages::name(stages[i].second), pid, entry.thread, begin, stages[i].first);
+					output << ",\"args\":{\"trace_id\":\"" << trace_id << "\"}}";
+					begin = stages[i].first;
+				}
+			}
+			output << "\n]}\n";
+		}
+		bool write_chrome_json(const std::string& path)
+		{
+			std::ofstream file(path);
+			if (!file)
+				return false;
+			write_chrome_json(file);
+			return static_cast<bool>(file);
+		}
+
+	private:
+		static void write_event(std::ostream& output, const char* name, unsigned long long pid, std::size_t thread,
+			clock::time_point begin, clock::time_point end)
+		{
+			const double start = std::chrono::duration<double, std::micro>(begin.time_since_epoch()).count();
+			const double duration = std::chrono::duration<double, std::micro>(end - begin).count();
+			char times[64];
+			std::snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", start, duration);
+			output << ",\n{\"name\":\"" << name << "\",\"cat\":\"rpc\",\"ph\":\"X\",\"pid\":" << pid
+				<< ",\"tid\":" << (thread % 1000000) << ',' << times;
+		}
+
+		static unsigned long long process_id()
+		{
+#if PLATFORM == PLATFORM_WINDOWS
+			return static_cast<unsigned long long>(::_getpid());
+#else
+			return static_cast<unsigned long long>(::getpid());
+#endif
+		}
+
+		// splitmix64 per thread, seeded from the clock and the thread
+		static std::uint64_t next_random()
+		{
+			thread_local std::uint64_t state = static_cast<std::uint64_t>(clock::now().time_since_epoch().count())
+				^ std::hash<std::thread::id>{}(std::this_thread::get_id());
+			std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			return z ^ (z >> 31);
+		}
+	};
+
+	inline trace_span::~trace_span()
+	{
+		if (m_tracer)
+			m_tracer->record_span(*this);
+	}
+
+}
\ No newline at end of file
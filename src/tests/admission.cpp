@@ -0,0 +1,160 @@
+// checks admission_controller without a server: a critical call gets a slot while bulk calls fill theirs or
+// wait in the queue, queued calls are admitted highest class first, and the limit shrinks while calls report
+// queueing delays over the target and grows back once they don't.
+// Built as the rpc_test_admission target and run by ctest
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../rpc/admission.h"
+#include "check.h"
+
+namespace
+{
+
+	using rpc::admission_controller;
+	using tests::check;
+
+	const rpc::id_t bulk_call = 1;
+	const rpc::id_t normal_call = 2;
+	const rpc::id_t critical_call = 3;
+
+	admission_controller::clock::time_point never()
+	{
+		return admission_controller::clock::time_point::max();
+	}
+
+	// the limit is pinned, so admissions don't move it
+	rpc::admission_policy fixed_policy(std::size_t limit)
+	{
+		rpc::admission_policy policy;
+		policy.initial_limit = policy.min_limit = policy.max_limit = limit;
+		policy.max_queue_delay = std::chrono::seconds(30);
+		return policy;
+	}
+
+	void set_classes(admission_controller& controller)
+	{
+		controller.set_priority(bulk_call, rpc::priorities::bulk);
+		controller.set_priority(normal_call, rpc::priorities::normal);
+		controller.set_priority(critical_call, rpc::priorities::critical);
+	}
+
+	// true once the controller holds queued calls, false if they didn't show up within seconds
+	bool wait_queued(admission_controller& controller, std::size_t queued)
+	{
+		for (int i = 0; i < 5000 && controller.counters().queued != queued; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return controller.counters().queued == queued;
+	}
+
+	void check_saturated_lane()
+	{
+		admission_controller controller(fixed_policy(8));
+		set_classes(controller);
+		controller.set_limit(bulk_call, 2);
+		check(controller.acquire(bulk_call, never()) && controller.acquire(bulk_call, never()), "bulk calls up to their limit are admitted");
+		check(!controller.try_acquire(bulk_call, std::chrono::microseconds(0)), "bulk call over its limit is refused");
+		check(controller.acquire(critical_call, never()), "critical call is admitted while the bulk lane is full");
+		check(controller.counters().running == 3, "three calls run");
+		controller.release(critical_call);
+		controller.release(bulk_call);
+		controller.release(bulk_call);
+		check(controller.counters().running == 0, "released calls free their slots");
+	}
+
+	// every slot is taken and bulk calls wait, a critical call queued after them gets the next free slot
+	void check_queue_order()
+	{
+		admission_controller controller(fixed_policy(2));
+		set_classes(controller);
+		check(controller.acquire(bulk_call, never()) && controller.acquire(bulk_call, never()), "bulk calls take every slot");
+
+		std::atomic<int> bulk_admitted = 0;
+		std::atomic<bool> critical_admitted = false;
+		std::vector<std::thread> waiting;
+		for (int i = 0; i < 2; ++i) {
+			waiting.emplace_back([&]() {
+				if (controller.acquire(bulk_call, never()))
+					++bulk_admitted;
+			});
+		}
+		check(wait_queued(controller, 2), "bulk calls wait in the queue");
+		waiting.emplace_back([&]() { critical_admitted = controller.acquire(critical_call, never()); });
+		check(wait_queued(controller, 3), "critical call waits in the queue");
+
+		controller.release(bulk_call);
+		check(wait_queued(controller, 2), "a released slot admits one call");
+		check(critical_admitted && bulk_admitted == 0, "the critical call goes before the bulk calls queued earlier");
+
+		controller.release(critical_call);
+		controller.release(bulk_call);
+		for (std::thread& thread : waiting)
+			thread.join();
+		check(bulk_admitted == 2, "queued bulk calls are admitted once slots free up");
+		controller.release(bulk_call);
+		controller.release(bulk_call);
+		const rpc::admission_counters counters = controller.counters();
+		check(counters.running == 0 && counters.queued == 0 && counters.timed_out == 0, "nothing is left running or queued");
+	}
+
+	void check_adaptive_limit()
+	{
+		rpc::admission_policy policy;
+		policy.initial_limit = 64;
+		policy.min_limit = 4;
+		policy.max_limit = 128;
+		admission_controller controller(policy);
+		set_classes(controller);
+
+		const std::chrono::microseconds overloaded = policy.target_queue_delay * 2;
+		std::size_t limit = controller.counters().limit;
+		bool shrinking = true;
+		for (int i = 0; i < 10; ++i) {
+			if (controller.try_acquire(critical_call, overloaded))
+				controller.release(critical_call);
+			const std::size_t next = controller.counters().limit;
+			shrinking = shrinking && next < limit;
+			limit = next;
+		}
+		check(shrinking, "limit shrinks with every call that waited over the target");
+		for (int i = 0; i < 100; ++i) {
+			if (controller.try_acquire(critical_call, overloaded))
+				controller.release(critical_call);
+		}
+		check(controller.counters().limit == policy.min_limit, "limit bottoms out at min_limit");
+		std::size_t admitted = 0;
+		for (int i = 0; i < 10; ++i)
+			admitted += controller.try_acquire(critical_call, overloaded) ? 1 : 0;
+		check(admitted == policy.min_limit, "only min_limit calls are admitted under overload");
+		for (std::size_t i = 0; i < admitted; ++i)
+			controller.release(critical_call);
+
+		// waiting past the target sheds bulk calls, past max_queue_delay normal ones, critical ones still run
+		check(!controller.try_acquire(bulk_call, overloaded), "bulk call that waited over the target is shed");
+		check(controller.try_acquire(normal_call, overloaded), "normal call that waited over the target still runs");
+		controller.release(normal_call);
+		const std::chrono::microseconds too_long = policy.max_queue_delay * 2;
+		check(!controller.try_acquire(normal_call, too_long), "normal call that waited over max_queue_delay is shed");
+		check(controller.try_acquire(critical_call, too_long), "critical call runs whatever it waited");
+		controller.release(critical_call);
+
+		for (int i = 0; i < 200; ++i) {
+			if (controller.try_acquire(normal_call, std::chrono::microseconds(0)))
+				controller.release(normal_call);
+		}
+		check(controller.counters().limit > policy.min_limit * 2, "limit grows back once calls stop waiting");
+	}
+
+}
+
+int main()
+{
+	check_saturated_lane();
+	check_queue_order();
+	check_adaptive_limit();
+	return tests::result("admission");
+}
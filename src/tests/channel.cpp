@@ -0,0 +1,206 @@
+// checks channel flow control over a loopback connection: a writer of stream data stops once it spent the
+// credit of a consumer that doesn't read and goes on as the consumer catches up, and a cancel gives the window
+// back, be it the receiver dropping the call's queued data or a writer waiting for credit of a cancelled call.
+// Built as the rpc_test_channel target and run by ctest
+// usage: rpc_test_channel [--port <first port>]
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "../rpc/channel.h"
+#include "check.h"
+
+namespace
+{
+
+	using rpc::channel;
+	using tests::check;
+
+	const std::size_t chunk_size = 16 * net::kilobyte;
+	// both windows start at initial_window, this many chunks spend it
+	const std::size_t chunks_per_window = static_cast<std::size_t>(rpc::initial_window) / chunk_size;
+
+	// the two ends of a loopback connection
+	class connection
+	{
+	public:
+		std::atomic<rpc::flow_control_policy> policy;
+		net::socket<net::protocols::TCP, true> listener;
+		net::socket<net::protocols::TCP> writer_socket;
+		net::socket<net::protocols::TCP> reader_socket;
+		channel writer;
+		channel reader;
+		bool connected = false;
+
+		explicit connection(std::uint16_t port)
+		{
+			// the reader grants credit back in steps of half the initial window
+			rpc::flow_control_policy small;
+			small.connection_window = static_cast<std::uint32_t>(rpc::initial_window);
+			small.stream_window = static_cast<std::uint32_t>(rpc::initial_window);
+			policy = small;
+
+			if (!listener.create({ "127.0.0.1", port }) || !writer_socket.create({ "127.0.0.1", port }))
+				return;
+			if (!writer_socket.connect() || !listener.accept(reader_socket))
+				return;
+			writer = channel(writer_socket, policy);
+			reader = channel(reader_socket, policy);
+			connected = true;
+		}
+		~connection()
+		{
+			if (connected) {
+				writer_socket.close();
+				reader_socket.close();
+			}
+			listener.close();
+		}
+	};
+
+	misc::buffer<> chunk(rpc::call_id_t call_id, std::uint8_t fill)
+	{
+		misc::buffer<> frame = rpc::make_frame(chunk_size);
+		for (std::size_t i = 0; i < chunk_size; ++i)
+			frame.add(fill);
+		rpc::seal_frame(frame, call_id, rpc::frame_flags::stream_chunk);
+		return frame;
+	}
+
+	bool send_chunk(channel& writer, rpc::call_id_t call_id, std::uint8_t fill,
+		channel::clock::time_point deadline = channel::clock::time_point::max())
+	{
+		const misc::buffer<> frame = chunk(call_id, fill);
+		return writer.send_data(call_id, frame.data(), frame.size(), chunk_size, deadline);
+	}
+
+	// polls until the condition holds, false if it didn't within seconds
+	template<typename Condition>
+	bool eventually(Condition condition)
+	{
+		for (int i = 0; i < 5000 && !condition(); ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return condition();
+	}
+
+	void check_slow_consumer(std::uint16_t port)
+	{
+		connection link(port);
+		if (!check(link.connected, "loopback connection for the slow consumer"))
+			return;
+		const rpc::call_id_t stream = 7;
+		const std::size_t chunks = 8 * chunks_per_window;
+		link.writer.open_stream(stream);
+
+		std::atomic<std::size_t> sent = 0;
+		std::atomic<bool> all_sent = true;
+		std::thread writer([&]() {
+			for (std::size_t i = 0; i < chunks; ++i) {
+				if (!send_chunk(link.writer, stream, static_cast<std::uint8_t>(i))) {
+					all_sent = false;
+					return;
+				}
+				++sent;
+			}
+		});
+
+		// nothing is read yet: the writer spends the window and waits
+		check(eventually([&]() { return sent == chunks_per_window; }), "writer spends the initial window");
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		check(sent == chunks_per_window, "writer blocks once the credit is spent");
+
+		bool in_order = true;
+		for (std::size_t i = 0; i < chunks; ++i) {
+			rpc::frame_header header;
+			misc::buffer<> payload;
+			if (!link.reader.receive(header, payload)) {
+				in_order = false;
+				break;
+			}
+			in_order = in_order && header.call_id == stream && payload.size() == chunk_size
+				&& payload.data()[0] == static_cast<std::uint8_t>(i);
+			// handed to the consumer: credit of the connection and of the stream goes back
+			link.reader.consume(header.size);
+			link.reader.send_window_update(stream, header.size);
+			if (i == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		writer.join();
+		check(all_sent && sent == chunks, "writer resumes as the consumer reads");
+		check(in_order, "reader gets every chunk in order");
+	}
+
+	void check_cancel_frees_window(std::uint16_t port)
+	{
+		connection link(port);
+		if (!check(link.connected, "loopback connection for the cancelled call"))
+			return;
+		const rpc::call_id_t cancelled = 9;
+		const rpc::call_id_t next = 11;
+
+		bool sent = true;
+		for (std::size_t i = 0; i < chunks_per_window; ++i)
+			sent = send_chunk(link.writer, cancelled, 0) && sent;
+		check(sent, "data within the window is sent right away");
+		check(!send_chunk(link.writer, next, 0, channel::clock::now() + std::chrono::milliseconds(50)),
+			"another call finds the connection window spent");
+
+		// the reader queues the chunks, nobody consumes them until the call is cancelled
+		check(link.reader.wait(std::chrono::seconds(5)) == 0 && link.reader.poll(), "reader queues the chunks");
+		check(link.reader.has_pending(), "chunks wait in the reader's queue");
+		check(link.writer.send_cancel(cancelled), "cancel is sent");
+		check(eventually([&]() { return link.reader.poll() && !link.reader.has_pending(); }),
+			"cancel drops the queued chunks");
+
+		check(send_chunk(link.writer, next, 0, channel::clock::now() + std::chrono::seconds(5)),
+			"dropped data gives the window back to other calls");
+	}
+
+	void check_cancel_unblocks_writer(std::uint16_t port)
+	{
+		connection link(port);
+		if (!check(link.connected, "loopback connection for the cancelled writer"))
+			return;
+		const rpc::call_id_t running = 5;
+
+		std::atomic<std::size_t> sent = 0;
+		std::atomic<bool> gave_up = false;
+		const auto start = channel::clock::now();
+		std::atomic<channel::clock::duration> blocked_for{};
+		std::thread writer([&]() {
+			// as a server streaming the reply of the call it executes
+			link.writer.begin_call(running);
+			while (send_chunk(link.writer, running, 0, start + std::chrono::seconds(10)))
+				++sent;
+			gave_up = link.writer.is_cancelled();
+			blocked_for = channel::clock::now() - start;
+			link.writer.end_call();
+		});
+
+		check(eventually([&]() { return sent == chunks_per_window; }), "writer spends the window of the running call");
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		check(link.reader.send_cancel(running), "cancel is sent");
+		writer.join();
+		check(gave_up && sent == chunks_per_window, "writer waiting for credit gives up once the call is cancelled");
+		check(blocked_for.load() < std::chrono::seconds(5), "writer gives up without waiting for its deadline");
+	}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::uint16_t port = 39410;
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (std::string_view(argv[i]) == "--port")
+			port = static_cast<std::uint16_t>(std::atoi(argv[++i]));
+	}
+	check_slow_consumer(port);
+	check_cancel_frees_window(port + 1);
+	check_cancel_unblocks_writer(port + 2);
+	return tests::result("channel");
+}
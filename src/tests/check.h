@@ -0,0 +1,37 @@
+#pragma once
+
+// minimal checking for the unit tests under src/tests: failed checks are printed and counted,
+// main returns result() so ctest sees the failure
+
+#include <iostream>
+#include <string_view>
+
+namespace tests
+{
+
+	inline int& failures()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline bool check(bool condition, std::string_view what)
+	{
+		if (!condition) {
+			std::cout << "failed: " << what << '\n';
+			++failures();
+		}
+		return condition;
+	}
+
+	// exit code of a test
+	inline int result(std::string_view name)
+	{
+		if (failures() == 0)
+			std::cout << name << ": passed\n";
+		else
+			std::cout << name << ": " << failures() << " checks failed\n";
+		return (failures() == 0) ? 0 : 1;
+	}
+
+}
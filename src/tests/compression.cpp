@@ -0,0 +1,133 @@
+// round trips of the lz codec: empty, incompressible, highly repetitive and larger than the 64KB match window
+// inputs, lengths around the token and extension boundaries, hand-made streams whose matches overlap their
+// own output, and malformed streams that decompress has to reject.
+// Built as the rpc_test_compression target and run by ctest
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../rpc/compression.h"
+#include "check.h"
+
+namespace
+{
+
+	using tests::check;
+	using bytes = std::vector<std::uint8_t>;
+
+	// compressed size, or 0 if the round trip failed
+	std::size_t round_trip(const bytes& input, const std::string& name)
+	{
+		bytes compressed(rpc::lz::max_compressed_size(input.size()));
+		const std::size_t compressed_size = rpc::lz::compress(input.data(), input.size(), compressed.data(), compressed.size());
+		if (!check(compressed_size > 0, name + " compresses"))
+			return 0;
+		bytes output(input.size());
+		const bool decompressed = rpc::lz::decompress(compressed.data(), compressed_size, output.data(), output.size());
+		check(decompressed, name + " decompresses");
+		check(output == input, name + " round trips");
+		return decompressed && output == input ? compressed_size : 0;
+	}
+
+	bytes random_bytes(std::size_t size, std::uint64_t seed)
+	{
+		bytes data(size);
+		for (std::uint8_t& byte : data) {
+			// xorshift, the same bytes on every run
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			byte = static_cast<std::uint8_t>(seed);
+		}
+		return data;
+	}
+
+	void check_round_trips()
+	{
+		const std::size_t empty = round_trip({}, "empty input");
+		check(empty == 1, "empty input is a single token");
+
+		const bytes noise = random_bytes(100000, 88172645463325252ull);
+		const std::size_t noise_size = round_trip(noise, "incompressible input");
+		check(noise_size <= rpc::lz::max_compressed_size(noise.size()), "incompressible input stays within the bound");
+
+		const std::size_t zeros = round_trip(bytes(200000, 0), "run of zeros");
+		check(zeros > 0 && zeros < 1000, "run of zeros compresses to under 1000 bytes");
+
+		bytes pattern(100000);
+		for (std::size_t i = 0; i < pattern.size(); ++i)
+			pattern[i] = static_cast<std::uint8_t>("abc"[i % 3]);
+		round_trip(pattern, "repeated short pattern");
+
+		// a block repeated past the 64KB window, only the copies within reach can be matched
+		const bytes block = random_bytes(70000, 2463534242ull);
+		bytes far;
+		for (int i = 0; i < 3; ++i)
+			far.insert(far.end(), block.begin(), block.end());
+		round_trip(far, "repeats farther than the match window");
+		const bytes prefix(block.begin(), block.begin() + 40000);
+		bytes near = prefix;
+		near.insert(near.end(), prefix.begin(), prefix.end());
+		near.insert(near.end(), noise.begin(), noise.end());
+		check(round_trip(near, "input over 64KB with near repeats") < near.size(), "near repeats are matched");
+
+		// literal and match lengths on both sides of the token limit of 15 and of each 255 extension byte
+		for (std::size_t length : { 1, 3, 4, 14, 15, 16, 18, 19, 20, 269, 270, 271, 524, 525, 526 }) {
+			bytes literals = random_bytes(length, 3141592653ull + length);
+			round_trip(literals, "literals of " + std::to_string(length));
+			const bytes head = random_bytes(8, 27182818ull);
+			bytes matched = head;
+			matched.insert(matched.end(), length, 'x');
+			matched.insert(matched.end(), head.begin(), head.end());
+			round_trip(matched, "match of " + std::to_string(length));
+		}
+	}
+
+	void check_overlapping_matches()
+	{
+		// "ab", then a match of 10 at offset 2 reading bytes it writes itself
+		const bytes period_two = { 0x26, 'a', 'b', 2, 0 };
+		bytes output(12);
+		check(rpc::lz::decompress(period_two.data(), period_two.size(), output.data(), output.size())
+			&& std::string(output.begin(), output.end()) == "abababababab", "match overlapping by two bytes");
+
+		// "x", then a match of 4 + 15 + 300 at offset 1 and trailing literals "yz"
+		const bytes period_one = { 0x1f, 'x', 1, 0, 255, 45, 0x20, 'y', 'z' };
+		output.assign(1 + 319 + 2, 0);
+		bytes expected(1 + 319, 'x');
+		expected.push_back('y');
+		expected.push_back('z');
+		check(rpc::lz::decompress(period_one.data(), period_one.size(), output.data(), output.size())
+			&& output == expected, "long match overlapping by one byte");
+	}
+
+	void check_malformed()
+	{
+		bytes output(16);
+		const bytes zero_offset = { 0x10, 'a', 0, 0 };
+		check(!rpc::lz::decompress(zero_offset.data(), zero_offset.size(), output.data(), 5), "zero offset is rejected");
+		const bytes far_offset = { 0x10, 'a', 2, 0 };
+		check(!rpc::lz::decompress(far_offset.data(), far_offset.size(), output.data(), 5), "offset before the output is rejected");
+		const bytes truncated = { 0x30, 'a', 'b' };
+		check(!rpc::lz::decompress(truncated.data(), truncated.size(), output.data(), 3), "truncated literals are rejected");
+		const bytes overflow = { 0x1f, 'a', 1, 0, 10 };
+		check(!rpc::lz::decompress(overflow.data(), overflow.size(), output.data(), output.size()), "match past the output is rejected");
+		const bytes short_output = { 0x20, 'a', 'b' };
+		check(!rpc::lz::decompress(short_output.data(), short_output.size(), output.data(), 3), "output of another size is rejected");
+
+		const bytes input(100, 'a');
+		bytes compressed(rpc::lz::max_compressed_size(input.size()) - 1);
+		check(rpc::lz::compress(input.data(), input.size(), compressed.data(), compressed.size()) == 0,
+			"compress refuses a destination below max_compressed_size");
+	}
+
+}
+
+int main()
+{
+	check_round_trips();
+	check_overlapping_matches();
+	check_malformed();
+	return tests::result("compression");
+}
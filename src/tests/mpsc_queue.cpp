@@ -0,0 +1,137 @@
+// stress test of mpsc_queue and of the mailbox built on it: producers push concurrently with the consumer,
+// every node must come out exactly once and in the order its producer pushed it. The mailboxes share their
+// recycled nodes, so tasks are posted to two of them run by different owners.
+// Built as the rpc_test_mpsc_queue target and run by ctest
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../rpc/mpsc_queue.h"
+#include "../rpc/shard.h"
+#include "check.h"
+
+namespace
+{
+
+	using tests::check;
+
+	constexpr std::size_t producers = 4;
+
+	struct item : rpc::mpsc_node
+	{
+		std::size_t producer = 0;
+		std::size_t sequence = 0;
+	};
+
+	void check_queue(std::size_t per_producer)
+	{
+		rpc::mpsc_queue queue;
+		std::vector<std::unique_ptr<item[]>> items;
+		for (std::size_t p = 0; p < producers; ++p)
+			items.push_back(std::make_unique<item[]>(per_producer));
+		std::atomic<std::size_t> started = 0;
+		std::vector<std::thread> threads;
+		for (std::size_t p = 0; p < producers; ++p) {
+			threads.emplace_back([&, p]() {
+				++started;
+				while (started < producers)
+					std::this_thread::yield();
+				for (std::size_t i = 0; i < per_producer; ++i) {
+					items[p][i].producer = p;
+					items[p][i].sequence = i;
+					queue.push(&items[p][i]);
+				}
+			});
+		}
+
+		// next sequence expected of each producer
+		std::vector<std::size_t> expected(producers, 0);
+		std::size_t popped = 0;
+		bool ordered = true;
+		while (popped < producers * per_producer) {
+			rpc::mpsc_node* node = queue.pop();
+			if (!node)
+				continue;
+			const item& next = *static_cast<item*>(node);
+			ordered = ordered && next.sequence == expected[next.producer];
+			expected[next.producer] = next.sequence + 1;
+			++popped;
+		}
+		for (std::thread& thread : threads)
+			thread.join();
+
+		check(ordered, "queue keeps the order of each producer");
+		check(queue.pop() == nullptr, "queue is empty once everything was popped");
+		for (std::size_t p = 0; p < producers; ++p)
+			check(expected[p] == per_producer, "every node of producer " + std::to_string(p) + " came out");
+	}
+
+	// owner thread of a mailbox, runs tasks until told to stop
+	class owner
+	{
+	public:
+		rpc::mailbox box;
+		std::atomic<bool> stopping = false;
+		std::thread thread;
+
+		owner() : thread([this]() {
+			while (!stopping) {
+				const socket_t handle = box.handle();
+				if (net::wait_readable(&handle, 1, std::chrono::milliseconds(10)) > 0)
+					box.run();
+			}
+			box.run();
+		}) {}
+		~owner()
+		{
+			stopping = true;
+			thread.join();
+		}
+	};
+
+	void check_mailboxes(std::size_t per_producer)
+	{
+		// written by the owners only, each producer posts to a mailbox of its own
+		std::vector<std::size_t> expected(producers, 0);
+		std::vector<char> ordered(producers, 1);
+		std::atomic<std::size_t> ran = 0;
+		{
+			owner owners[2];
+			check(owners[0].box.is_open() && owners[1].box.is_open(), "mailboxes open");
+			std::vector<std::thread> threads;
+			for (std::size_t p = 0; p < producers; ++p) {
+				threads.emplace_back([&, p]() {
+					rpc::mailbox& box = owners[p % 2].box;
+					for (std::size_t i = 0; i < per_producer; ++i) {
+						box.post([&, p, i]() {
+							if (i != expected[p])
+								ordered[p] = 0;
+							expected[p] = i + 1;
+							ran.fetch_add(1, std::memory_order_relaxed);
+						});
+					}
+				});
+			}
+			for (std::thread& thread : threads)
+				thread.join();
+			// the owners are joined here, after running what is left
+		}
+
+		check(ran == producers * per_producer, "every posted task ran once");
+		for (std::size_t p = 0; p < producers; ++p)
+			check(ordered[p] && expected[p] == per_producer, "tasks of producer " + std::to_string(p) + " ran in order");
+	}
+
+}
+
+int main()
+{
+	check_queue(250000);
+	check_mailboxes(100000);
+	return tests::result("mpsc_queue");
+}
@@ -0,0 +1,102 @@
+// checks timing_wheel on a clock of its own: timers fire on their tick and not before, across the
+// boundaries where higher levels cascade down, and cancelling a timer once it fired is harmless.
+// Built as the rpc_test_timing_wheel target and run by ctest
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../rpc/timing_wheel.h"
+#include "check.h"
+
+namespace
+{
+
+	using rpc::timing_wheel;
+	using tests::check;
+
+	const timing_wheel::clock::time_point start{};
+
+	timing_wheel::clock::time_point at(std::uint64_t tick)
+	{
+		return start + std::chrono::milliseconds(tick);
+	}
+
+	// one timer per delay, each remembering the tick it fired on; scheduled once the wheel reached from
+	void check_cascade(std::uint64_t from, const std::vector<std::uint64_t>& delays)
+	{
+		timing_wheel wheel(std::chrono::milliseconds(1), start);
+		wheel.advance(at(from));
+		std::uint64_t now = from;
+		std::vector<std::uint64_t> fired_at(delays.size(), 0);
+		std::vector<timing_wheel::timer> timers(delays.size());
+		for (std::size_t i = 0; i < delays.size(); ++i) {
+			timers[i].callback = [&fired_at, &now, i]() { fired_at[i] = now; };
+			wheel.schedule(timers[i], std::chrono::milliseconds(delays[i]));
+		}
+
+		for (std::size_t i = 0; i < delays.size(); ++i) {
+			const std::uint64_t due = from + delays[i];
+			const std::string name = "timer of " + std::to_string(delays[i]) + " ticks from " + std::to_string(from);
+			// a tick short of it, then on it
+			now = due - 1;
+			wheel.advance(at(now));
+			check(fired_at[i] == 0, name + " fires late enough");
+			now = due;
+			wheel.advance(at(now));
+			check(fired_at[i] == due, name + " fires on its tick");
+		}
+		check(wheel.size() == 0, "every timer fired");
+	}
+
+	void check_cancel_after_fire()
+	{
+		timing_wheel wheel(std::chrono::milliseconds(1), start);
+		int fired = 0;
+		timing_wheel::timer once([&fired]() { ++fired; });
+		wheel.schedule(once, std::chrono::milliseconds(5));
+		check(wheel.advance(at(5)) == 1 && fired == 1, "timer fires once due");
+		check(!once.is_scheduled() && wheel.size() == 0, "fired timer is no longer scheduled");
+		once.cancel();
+		wheel.cancel(once);
+		check(wheel.size() == 0, "cancelling a fired timer leaves the count alone");
+		check(wheel.advance(at(600)) == 0 && fired == 1, "cancelled fired timer doesn't fire again");
+
+		// rescheduled after firing, it fires again
+		wheel.schedule(once, std::chrono::milliseconds(3));
+		check(wheel.advance(at(603)) == 1 && fired == 2, "fired timer can be scheduled again");
+
+		// a callback cancelling a timer of the same slot that hasn't fired yet
+		timing_wheel::timer second([&fired]() { fired += 10; });
+		timing_wheel::timer first([&]() { ++fired; second.cancel(); });
+		wheel.schedule(second, std::chrono::milliseconds(2));
+		wheel.schedule(first, std::chrono::milliseconds(2));
+		check(wheel.advance(at(605)) == 1 && fired == 3, "timer cancelled by a callback of its slot doesn't fire");
+		check(wheel.size() == 0, "nothing left scheduled");
+
+		// a callback rescheduling its own timer
+		int repeats = 0;
+		timing_wheel::timer periodic;
+		periodic.callback = [&]() {
+			if (++repeats < 3)
+				wheel.schedule(periodic, std::chrono::milliseconds(300));
+		};
+		wheel.schedule(periodic, std::chrono::milliseconds(300));
+		wheel.advance(at(605 + 900));
+		check(repeats == 3 && !periodic.is_scheduled(), "timer rescheduled by its callback fires each time");
+	}
+
+}
+
+int main()
+{
+	const std::uint64_t slots = timing_wheel::slots;
+	// around the level boundaries, scheduled from the start and from the middle of a slot
+	const std::vector<std::uint64_t> delays = { 1, 2, slots - 1, slots, slots + 1, 2 * slots + 7,
+		slots * slots - 1, slots * slots, slots * slots + 1, slots * slots * slots + 5 };
+	check_cascade(0, delays);
+	check_cascade(slots * 3 + 100, delays);
+	check_cancel_after_fire();
+	return tests::result("timing_wheel");
+}